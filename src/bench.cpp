@@ -0,0 +1,467 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <thread>
+#include <fmt/core.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "dithering.hpp"
+#include "blue_noise.hpp"
+#include "image_source.hpp"
+#include "project.hpp"
+#include "threads.hpp"
+#include "catalogue.hpp"
+#include "paths.hpp"
+
+using namespace std::chrono;
+
+// Runs every dithering algorithm over a fixed set of images and sizes, reporting speed, memory and
+// how far the pattern is from the image as JSON, so results can be compared between commits.
+
+static const char *USAGE =
+    "Usage: x-stitch-bench [options]\n"
+    "\n"
+    "Options:\n"
+    "  --sizes <a,b,...>     Widths to dither at, defaults to 64,256,1024\n"
+    "  --repeats <number>    Times each run is repeated, the median time is reported, defaults to 3\n"
+    "  --image <path>        Adds a real image to the generated ones, can be given more than once\n"
+    "  --filter <text>       Only runs whose name contains text\n"
+    "  --max-threads <n>     Palette size used for the reduced runs, defaults to 30\n"
+    "  --label <text>        Stored in the output, e.g. the commit being measured\n"
+    "  --output <path>       Writes the JSON here instead of to stdout\n"
+    "  --palette <file.xml>  Thread manufacturer to use, defaults to DMC\n"
+    "  --help                Show this message\n";
+
+struct BenchImage {
+    std::string name;
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+};
+
+struct BenchAlgorithm {
+    std::string name;
+    int algorithm;
+    int bayer_order = BayerOrders::FOUR;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string image;
+    int width;
+    int height;
+    std::string algorithm;
+    int max_threads;
+    bool blend_threads;
+    bool refine_palette;
+    double seconds;
+    double megapixels_per_second;
+    long peak_rss_kb;
+    double mean_delta_e;
+    int threads_used;
+};
+
+/* Generated images */
+
+// Smooth ramps in all three channels, shows banding and how gradients are dithered
+static void generate_gradient(unsigned char *pixels, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char *pixel = &pixels[4 * INDEX(x, y, width)];
+            pixel[0] = (x * 255) / std::max(1, width - 1);
+            pixel[1] = (y * 255) / std::max(1, height - 1);
+            pixel[2] = 255 - (((x + y) * 255) / std::max(1, width + height - 2));
+            pixel[3] = 255;
+        }
+    }
+}
+
+// Soft overlapping blobs of colour, standing in for a photograph
+static void generate_blobs(unsigned char *pixels, int width, int height) {
+    std::mt19937 rng(0xb10b5);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    struct Blob { float x, y, radius, r, g, b; };
+    std::vector<Blob> blobs(24);
+    for (Blob& blob : blobs)
+        blob = {unit(rng), unit(rng), 0.05f + 0.25f * unit(rng), 255 * unit(rng), 255 * unit(rng), 255 * unit(rng)};
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float u = (x + 0.5f) / width;
+            float v = (y + 0.5f) / height;
+            float r = 0.f, g = 0.f, b = 0.f, total = 1e-6f;
+            for (const Blob& blob : blobs) {
+                float d2 = ((u - blob.x) * (u - blob.x) + (v - blob.y) * (v - blob.y)) / (blob.radius * blob.radius);
+                float weight = std::exp(-d2);
+                r += weight * blob.r;
+                g += weight * blob.g;
+                b += weight * blob.b;
+                total += weight;
+            }
+            unsigned char *pixel = &pixels[4 * INDEX(x, y, width)];
+            pixel[0] = std::clamp((int)(r / total), 0, 255);
+            pixel[1] = std::clamp((int)(g / total), 0, 255);
+            pixel[2] = std::clamp((int)(b / total), 0, 255);
+            pixel[3] = 255;
+        }
+    }
+}
+
+// Hard edged shapes in a few flat colours, like a logo or cartoon
+static void generate_shapes(unsigned char *pixels, int width, int height) {
+    const unsigned char colours[6][3] = {{230, 57, 70}, {241, 250, 238}, {168, 218, 220}, {69, 123, 157}, {29, 53, 87}, {255, 183, 3}};
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float u = (x + 0.5f) / width;
+            float v = (y + 0.5f) / height;
+            int colour = 0;
+            if ((u - 0.35f) * (u - 0.35f) + (v - 0.4f) * (v - 0.4f) < 0.06f)
+                colour = 1;
+            else if (u > 0.55f && u < 0.9f && v > 0.2f && v < 0.7f)
+                colour = 2;
+            else if (v > 0.75f)
+                colour = (u < 0.5f) ? 3 : 4;
+            else if (u + v < 0.3f)
+                colour = 5;
+            unsigned char *pixel = &pixels[4 * INDEX(x, y, width)];
+            pixel[0] = colours[colour][0];
+            pixel[1] = colours[colour][1];
+            pixel[2] = colours[colour][2];
+            pixel[3] = 255;
+        }
+    }
+}
+
+// Uniformly random colours, the worst case for the nearest colour caches
+static void generate_noise(unsigned char *pixels, int width, int height) {
+    std::mt19937 rng(0x4015e);
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        uint32_t value = rng();
+        pixels[4*i] = value & 0xff;
+        pixels[4*i+1] = (value >> 8) & 0xff;
+        pixels[4*i+2] = (value >> 16) & 0xff;
+        pixels[4*i+3] = 255;
+    }
+}
+
+static std::vector<BenchImage> create_corpus(const std::vector<int>& sizes, const std::vector<std::string>& image_paths) {
+    typedef void (*Generator)(unsigned char*, int, int);
+    const std::pair<const char*, Generator> generators[] = {
+        {"gradient", generate_gradient},
+        {"blobs", generate_blobs},
+        {"shapes", generate_shapes},
+        {"noise", generate_noise}
+    };
+
+    std::vector<BenchImage> corpus;
+    for (int size : sizes) {
+        for (const auto& [name, generator] : generators) {
+            BenchImage image{name, size, size, std::vector<unsigned char>((size_t)size * size * 4)};
+            generator(image.pixels.data(), size, size);
+            corpus.push_back(std::move(image));
+        }
+
+        for (const std::string& path : image_paths) {
+            std::unique_ptr<ImageSource> source = open_image(path);
+            int height = std::max(1, (int)std::lround((double)size * source->height() / source->width()));
+            BenchImage image{path, size, height, std::vector<unsigned char>((size_t)size * height * 4)};
+            resize_image(source.get(), image.pixels.data(), size, height);
+            corpus.push_back(std::move(image));
+        }
+    }
+    return corpus;
+}
+
+/* Measurements */
+
+// Mean distance between each opaque pixel of reference and the thread stitched for it, in the same
+// space threads are matched in: rgb_to_oklab on the sRGB values as they are, without linearising.
+// Blank stitches are compared against the project's background.
+static double mean_delta_e(const std::vector<unsigned char>& reference, int width, int height, Project *project) {
+    Lab background = rgb_to_oklab(color_float_to_int(project->bg_color.r()),
+                                   color_float_to_int(project->bg_color.g()),
+                                   color_float_to_int(project->bg_color.b()));
+    double total = 0.0;
+    size_t count = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char *pixel = &reference[4 * INDEX(x, y, width)];
+            if (pixel[3] == 0)
+                continue;
+
+            Lab expected = rgb_to_oklab(pixel[0], pixel[1], pixel[2]);
+            Thread *thread = project->find_thread_at_stitch(nanogui::Vector2i(x, height - y - 1));
+            Lab actual = thread ? thread->lab : background;
+            double dL = expected.L - actual.L;
+            double da = expected.a - actual.a;
+            double db = expected.b - actual.b;
+            total += std::sqrt(dL * dL + da * da + db * db);
+            count++;
+        }
+    }
+    return count ? total / count : 0.0;
+}
+
+// Lets peak_rss_kb measure a single run rather than the whole process, where the OS supports it
+static void reset_peak_rss() {
+#if defined(__linux__)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs)
+        clear_refs << "5";
+#endif
+}
+
+static long peak_rss_kb() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::stol(line.substr(6));
+    }
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/* Output */
+
+static std::string json_string(const std::string& value) {
+    std::string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if ((unsigned char)c < 0x20) {
+            result += fmt::format("\\u{:04x}", (int)c);
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+static std::string to_json(const std::vector<BenchResult>& results, const std::string& label, int repeats) {
+    std::string json = "{\n";
+    json += fmt::format("  \"label\": {},\n", json_string(label));
+    json += fmt::format("  \"hardware_concurrency\": {},\n", std::thread::hardware_concurrency());
+    json += fmt::format("  \"repeats\": {},\n", repeats);
+    json += "  \"results\": [\n";
+    for (int i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        json += fmt::format("    {{\"name\": {}, \"image\": {}, \"width\": {}, \"height\": {}, \"algorithm\": {}, "
+                            "\"max_threads\": {}, \"blend_threads\": {}, \"refine_palette\": {}, \"seconds\": {:.6f}, "
+                            "\"megapixels_per_second\": {:.4f}, \"peak_rss_kb\": {}, \"mean_delta_e\": {:.6f}, \"threads_used\": {}}}{}\n",
+                            json_string(r.name), json_string(r.image), r.width, r.height, json_string(r.algorithm),
+                            r.max_threads == INT_MAX ? "null" : std::to_string(r.max_threads), r.blend_threads ? "true" : "false",
+                            r.refine_palette ? "true" : "false",
+                            r.seconds, r.megapixels_per_second, r.peak_rss_kb, r.mean_delta_e, r.threads_used,
+                            i + 1 < results.size() ? "," : "");
+    }
+    json += "  ]\n}\n";
+    return json;
+}
+
+/* Running */
+
+static BenchResult run_benchmark(const std::string& name, const BenchImage& image, const BenchAlgorithm& algorithm, int max_threads,
+                                 bool blend_threads, bool refine_palette, std::vector<Thread*> *palette, int repeats) {
+    DitheringSettings settings;
+    settings.algorithm = algorithm.algorithm;
+    settings.bayer_order = algorithm.bayer_order;
+    settings.max_threads = max_threads;
+    settings.blend_threads = blend_threads;
+    settings.refine_palette = refine_palette;
+
+    nanogui::Color background(255, 255, 255, 255);
+    // What the pattern should look like, the image after its transparency has been dealt with
+    std::vector<unsigned char> reference = image.pixels;
+    prepare_alpha(reference.data(), image.width, image.height, settings.alpha_mode, settings.alpha_cutoff, background);
+
+    std::vector<double> times;
+    long peak_rss = 0;
+    double delta_e = 0.0;
+    int threads_used = 0;
+    for (int i = 0; i < repeats; i++) {
+        std::vector<unsigned char> pixels = image.pixels;
+        Project project("Benchmark", image.width, image.height, background);
+
+        reset_peak_rss();
+        auto start = high_resolution_clock::now();
+        dither_image(settings, palette, pixels.data(), image.width, image.height, &project);
+        times.push_back(duration<double>(high_resolution_clock::now() - start).count());
+        peak_rss = std::max(peak_rss, peak_rss_kb());
+
+        if (i == repeats - 1) {
+            delta_e = mean_delta_e(reference, image.width, image.height, &project);
+            threads_used = std::count_if(project.palette.begin(), project.palette.end(), [](Thread *t) { return t != nullptr; });
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    double seconds = times[times.size() / 2];
+    return BenchResult{
+        name, image.name, image.width, image.height, algorithm.name, max_threads, blend_threads, refine_palette, seconds,
+        ((double)image.width * image.height / 1e6) / std::max(seconds, 1e-9), peak_rss, delta_e, threads_used
+    };
+}
+
+static std::vector<int> parse_sizes(const std::string& value) {
+    std::vector<int> sizes;
+    std::stringstream stream(value);
+    std::string size;
+    while (std::getline(stream, size, ',')) {
+        int parsed = std::atoi(size.c_str());
+        if (parsed < 1)
+            throw std::invalid_argument(fmt::format("Invalid size '{}'", size));
+        sizes.push_back(parsed);
+    }
+    return sizes;
+}
+
+int main(int argc, char **argv) {
+    std::vector<int> sizes = {64, 256, 1024};
+    int repeats = 3;
+    int reduced_threads = 30;
+    std::vector<std::string> image_paths;
+    std::vector<std::string> palette_paths;
+    std::string filter;
+    std::string label;
+    std::string output_path;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help") {
+                std::cout << USAGE;
+                return 0;
+            }
+            if (i + 1 >= argc)
+                throw std::invalid_argument(fmt::format("Unrecognised option {}", arg));
+
+            std::string value = argv[++i];
+            if (arg == "--sizes")
+                sizes = parse_sizes(value);
+            else if (arg == "--repeats")
+                repeats = std::max(1, std::atoi(value.c_str()));
+            else if (arg == "--image")
+                image_paths.push_back(value);
+            else if (arg == "--filter")
+                filter = value;
+            else if (arg == "--max-threads")
+                reduced_threads = std::max(1, std::atoi(value.c_str()));
+            else if (arg == "--label")
+                label = value;
+            else if (arg == "--output")
+                output_path = value;
+            else if (arg == "--palette")
+                palette_paths.push_back(value);
+            else
+                throw std::invalid_argument(fmt::format("Unrecognised option {}", arg));
+        }
+    } catch (const std::invalid_argument& err) {
+        std::cerr << err.what() << "\n\n" << USAGE;
+        return 2;
+    }
+
+#if defined(X_STITCH_RESOURCES_DIR)
+    set_resources_dir(X_STITCH_RESOURCES_DIR);
+#endif
+
+    // Own the threads in palette
+    std::vector<ThreadCatalogue> catalogues;
+    std::vector<Thread*> palette;
+    std::vector<BenchImage> corpus;
+    try {
+        if (palette_paths.empty())
+            palette_paths.push_back(get_resources_dir() + "/catalogues/DMC.xml");
+        for (const std::string& path : palette_paths) {
+            load_catalogue(path.c_str(), &catalogues.emplace_back());
+            for (SingleThread& thread : catalogues.back().threads())
+                palette.push_back(&thread);
+        }
+
+        corpus = create_corpus(sizes, image_paths);
+    } catch (const std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<BenchAlgorithm> algorithms = {
+        {"floyd-steinburg", DitheringAlgorithms::FLOYD_STEINBURG},
+        {"atkinson", DitheringAlgorithms::ATKINSON},
+        {"jarvis-judice-ninke", DitheringAlgorithms::JARVIS_JUDICE_NINKE},
+        {"stucki", DitheringAlgorithms::STUCKI},
+        {"sierra", DitheringAlgorithms::SIERRA},
+    };
+    for (int order : {BayerOrders::TWO, BayerOrders::FOUR, BayerOrders::EIGHT, BayerOrders::SIXTEEN, BayerOrders::THIRTY_TWO, BayerOrders::SIXTY_FOUR})
+        algorithms.push_back({fmt::format("bayer-{}", order), DitheringAlgorithms::BAYER, order});
+    algorithms.push_back({"blue-noise", DitheringAlgorithms::BLUE_NOISE});
+    algorithms.push_back({"quantise", DitheringAlgorithms::QUANTISE});
+
+    // Generated once up front, so the first blue noise run isn't timed making it
+    blue_noise_tile();
+
+    std::vector<BenchResult> results;
+    for (const BenchImage& image : corpus) {
+        for (const BenchAlgorithm& algorithm : algorithms) {
+            for (int max_threads : {INT_MAX, reduced_threads}) {
+                for (bool blend_threads : {false, true}) {
+                    // Refining only changes anything when the palette is reduced. Unrefined runs are
+                    // marked in their names, so the names of the others match earlier results.
+                    for (bool refine_palette : {true, false}) {
+                        if (!refine_palette && max_threads == INT_MAX)
+                            continue;
+
+                        std::string reduced = max_threads == INT_MAX ? "all" : std::to_string(max_threads);
+                        std::string name = fmt::format("{}/{}x{}/{}/threads={}/blend={}{}", image.name, image.width, image.height,
+                                                       algorithm.name, reduced, blend_threads ? "on" : "off", refine_palette ? "" : "/refine=off");
+                        if (!filter.empty() && name.find(filter) == std::string::npos)
+                            continue;
+
+                        BenchResult result = run_benchmark(name, image, algorithm, max_threads, blend_threads, refine_palette, &palette, repeats);
+                        std::cerr << fmt::format("{:<72} {:>9.3f} MP/s {:>8} KB  dE {:.4f}", result.name,
+                                                 result.megapixels_per_second, result.peak_rss_kb, result.mean_delta_e) << std::endl;
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+    }
+
+    std::string json = to_json(results, label, repeats);
+    if (output_path.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream output(output_path);
+        output << json;
+        if (!output) {
+            std::cerr << "Error: couldn't write " << output_path << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
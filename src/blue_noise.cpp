@@ -0,0 +1,195 @@
+#include "blue_noise.hpp"
+#include "paths.hpp"
+#include <cmath>
+#include <random>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+
+#define BLUE_NOISE_SEED 0x5eedU
+// Width of the gaussian used to measure how clustered the pattern is, 1.5 is Ulichney's value
+#define BLUE_NOISE_SIGMA 1.5f
+
+static const char CACHE_MAGIC[4] = {'X', 'S', 'B', 'N'};
+
+namespace {
+
+// A binary pattern on a torus, along with how much each pixel is surrounded by set pixels
+class VoidAndCluster {
+public:
+    VoidAndCluster(int size) : _size(size), _gaussian(size * size), _energy(size * size, 0.f), _pattern(size * size, 0) {
+        // Indexed by the offset between two pixels, wrapping round so the tile tiles seamlessly
+        for (int dy = 0; dy < size; dy++) {
+            for (int dx = 0; dx < size; dx++) {
+                int x = std::min(dx, size - dx);
+                int y = std::min(dy, size - dy);
+                _gaussian[dy * size + dx] = std::exp(-(x * x + y * y) / (2.f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+            }
+        }
+    };
+
+    bool is_set(int p) const { return _pattern[p]; };
+
+    void set(int p, bool value) {
+        if (_pattern[p] == value)
+            return;
+        _pattern[p] = value;
+
+        float sign = value ? 1.f : -1.f;
+        int px = p % _size;
+        int py = p / _size;
+        for (int y = 0; y < _size; y++) {
+            const float *gaussian_row = &_gaussian[((y - py + _size) % _size) * _size];
+            float *energy_row = &_energy[y * _size];
+            for (int x = 0; x < _size; x++)
+                energy_row[x] += sign * gaussian_row[(x - px + _size) % _size];
+        }
+    };
+
+    // The set pixel with the most set pixels around it
+    int tightest_cluster() const {
+        int best = -1;
+        for (int p = 0; p < _size * _size; p++) {
+            if (_pattern[p] && (best == -1 || _energy[p] > _energy[best]))
+                best = p;
+        }
+        return best;
+    };
+
+    // The unset pixel with the fewest set pixels around it
+    int largest_void() const {
+        int best = -1;
+        for (int p = 0; p < _size * _size; p++) {
+            if (!_pattern[p] && (best == -1 || _energy[p] < _energy[best]))
+                best = p;
+        }
+        return best;
+    };
+
+private:
+    int _size;
+    std::vector<float> _gaussian;
+    std::vector<float> _energy;
+    std::vector<uint8_t> _pattern;
+};
+
+std::string cache_path() {
+    return get_cache_dir() + "/blue_noise_" + std::to_string(BLUE_NOISE_SIZE) + ".bin";
+}
+
+bool load_tile(const std::string& path, std::vector<uint16_t> *tile) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[4];
+    uint32_t size, seed;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&size, sizeof(size));
+    file.read((char*)&seed, sizeof(seed));
+    if (!file || !std::equal(magic, magic + 4, CACHE_MAGIC) || size != BLUE_NOISE_SIZE || seed != BLUE_NOISE_SEED)
+        return false;
+
+    tile->resize(size * size);
+    file.read((char*)tile->data(), tile->size() * sizeof(uint16_t));
+    if (!file)
+        return false;
+
+    // Every rank has to appear exactly once, anything else is a truncated or corrupt file
+    std::vector<bool> seen(tile->size(), false);
+    for (uint16_t rank : *tile) {
+        if (rank >= tile->size() || seen[rank])
+            return false;
+        seen[rank] = true;
+    }
+    return true;
+}
+
+void save_tile(const std::string& path, const std::vector<uint16_t>& tile) {
+    // Written to a temporary file first so that another instance never reads half a tile
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        uint32_t size = BLUE_NOISE_SIZE;
+        uint32_t seed = BLUE_NOISE_SEED;
+        file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        file.write((const char*)&size, sizeof(size));
+        file.write((const char*)&seed, sizeof(seed));
+        file.write((const char*)tile.data(), tile.size() * sizeof(uint16_t));
+        if (!file)
+            return;
+    }
+
+    std::error_code err;
+    std::filesystem::rename(temp_path, path, err);
+    if (err)
+        std::cout << "Unable to cache blue noise tile: " << err.message() << std::endl;
+}
+
+}
+
+std::vector<uint16_t> void_and_cluster(int size, uint32_t seed) {
+    int cells = size * size;
+    VoidAndCluster prototype(size);
+
+    // Start with 10% of pixels set at random. mt19937 output is the same everywhere, unlike the
+    // standard distributions, so the tile doesn't depend on the standard library in use.
+    std::mt19937 rng(seed);
+    int ones = std::max(1, cells / 10);
+    for (int placed = 0; placed < ones;) {
+        int p = rng() % cells;
+        if (!prototype.is_set(p)) {
+            prototype.set(p, true);
+            placed++;
+        }
+    }
+
+    // Move the pixel in the tightest cluster into the largest void until that no longer changes
+    // anything, which spreads the initial pixels out evenly
+    for (int i = 0; i < cells; i++) {
+        int cluster = prototype.tightest_cluster();
+        prototype.set(cluster, false);
+        int gap = prototype.largest_void();
+        prototype.set(gap, true);
+        if (gap == cluster)
+            break;
+    }
+
+    std::vector<uint16_t> ranks(cells);
+
+    // Phase 1: remove the initial pixels from the tightest cluster first, giving them the
+    // highest ranks below the number of initial pixels
+    VoidAndCluster pattern = prototype;
+    for (int rank = ones - 1; rank >= 0; rank--) {
+        int cluster = pattern.tightest_cluster();
+        pattern.set(cluster, false);
+        ranks[cluster] = rank;
+    }
+
+    // Phases 2 and 3: fill the largest void until every pixel is set. Past the half way point
+    // Ulichney swaps to finding the tightest cluster of unset pixels, with a gaussian covering the
+    // whole tile the energy of the unset pixels is a constant minus the energy of the set pixels,
+    // so that is the same pixel as the largest void.
+    pattern = prototype;
+    for (int rank = ones; rank < cells; rank++) {
+        int gap = pattern.largest_void();
+        pattern.set(gap, true);
+        ranks[gap] = rank;
+    }
+
+    return ranks;
+}
+
+const std::vector<uint16_t>& blue_noise_tile() {
+    static const std::vector<uint16_t> tile = []() {
+        std::string path = cache_path();
+        std::vector<uint16_t> tile;
+        if (load_tile(path, &tile))
+            return tile;
+
+        tile = void_and_cluster(BLUE_NOISE_SIZE, BLUE_NOISE_SEED);
+        save_tile(path, tile);
+        return tile;
+    }();
+    return tile;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// Width and height of the blue noise tile, must be a power of two
+#define BLUE_NOISE_SIZE 64
+
+// Generates a size x size tile using Ulichney's void-and-cluster method. Each entry is the rank
+// of that pixel, from 0 to size*size - 1, stored row by row. The tile wraps around seamlessly and
+// only depends on size and seed.
+std::vector<uint16_t> void_and_cluster(int size, uint32_t seed);
+
+// The BLUE_NOISE_SIZE tile used for blue noise dithering. Generating it takes a noticeable amount
+// of time, so it is done on first use and cached on disk for later runs.
+const std::vector<uint16_t>& blue_noise_tile();
@@ -48,6 +48,7 @@ bool Camera2D::pan_camera(Vector2f delta, float position[3*4]) {
 
     _translation_x = new_x;
     _translation_y = new_y;
+    _app->redraw();
     return true;
 }
 
@@ -59,6 +60,7 @@ bool Camera2D::zoom_camera(float zoom, float position[3*4]) {
         return false;
 
     _scale = std::max(_minimum_scale, std::min(_maximum_scale, new_scale));
+    _app->redraw();
     return true;
 }
 
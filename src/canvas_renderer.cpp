@@ -10,6 +10,7 @@
 #include "camera2d.hpp"
 #include "project.hpp"
 #include "threads.hpp"
+#include "profiler.hpp"
 
 using namespace nanogui;
 
@@ -17,8 +18,8 @@ CanvasRenderer::CanvasRenderer(XStitchEditorApplication *app) :
     _app(app),
     _render_pass(new RenderPass({app})),
     _cross_stitch_shader(new Shader(_render_pass.get(), "cross_stitches", CROSS_STITCH_VERT, CROSS_STITCH_FRAG)),
-    _minor_grid_shader(new Shader(_render_pass.get(), "minor_grid", MINOR_GRID_VERT, MINOR_GRID_FRAG)),
-    _major_grid_shader(new Shader(_render_pass.get(), "major_grid", MAJOR_GRID_VERT, MAJOR_GRID_FRAG)),
+    // Drawn over the cross stitches using the same quad, blending in the lines it finds for each pixel
+    _grid_shader(new Shader(_render_pass.get(), "grid", CROSS_STITCH_VERT, GRID_FRAG, Shader::BlendMode::AlphaBlend)),
     _back_stitch_shader(new Shader(_render_pass.get(), "back_stitch", BACK_STITCH_VERT, BACK_STITCH_FRAG)),
     _back_stitch_ghost_shader(new Shader(_render_pass.get(), "back_stitch_ghost", BACK_STITCH_VERT, BACK_STITCH_FRAG))
 {
@@ -27,14 +28,14 @@ CanvasRenderer::CanvasRenderer(XStitchEditorApplication *app) :
 };
 
 void CanvasRenderer::deactivate() {
-    _major_grid_indices_size = 0;
-    _minor_grid_indices_size = 0;
     _backstitch_indices_size = 0;
     _backstitch_ghost_indices_size = 0;
     _drawing = false;
 }
 
 void CanvasRenderer::update_all_buffers() {
+    PROFILE_SCOPE("update all buffers");
+    _app->redraw();
     int width = _app->_project->width;
     int height = _app->_project->height;
 
@@ -62,8 +63,6 @@ void CanvasRenderer::update_all_buffers() {
         _h = (float)width / (float)height;
     }
 
-    _canvas_height_ndc = _v * 2.f;
-
     float position[3*4] = {
         -_h, -_v, 0,
          _h, -_v, 0,
@@ -87,113 +86,17 @@ void CanvasRenderer::update_all_buffers() {
     _cross_stitch_shader->set_buffer("indices", VariableType::UInt32, {3*2}, indices);
     _cross_stitch_shader->set_texture("cross_stitch_texture", _texture.get());
 
-    _minor_grid_mark_distance = 2.f / (float)std::max(width, height); // ndc space is 2.f long in the axis that is largest
-    float major_grid_mark_distance = _minor_grid_mark_distance * 10.f;
-
-    int width_minus_1 = width - 1;
-    int height_minus_1 = height - 1;
-
-    int minor_grid_total_verts = (height_minus_1 * 4) + (width_minus_1 * 4);
-    int major_grid_total_horizontal_verts = (height_minus_1 / 10) * 8;
-    int major_grid_total_vertical_verts = (width_minus_1 / 10) * 8;
-    int major_grid_total_verts = major_grid_total_horizontal_verts + major_grid_total_vertical_verts;
-    float minor_gridmarks[minor_grid_total_verts];
-    float major_gridmarks[major_grid_total_verts];
-
-    float x = -_h;
-    for (int i = 0; i < width_minus_1; i++) {
-        x += _minor_grid_mark_distance;
-        // two points, forming a line
-        minor_gridmarks[4*i] =        x;
-        minor_gridmarks[(4*i) + 1] =  _v;
-        minor_gridmarks[(4*i) + 2] =  x;
-        minor_gridmarks[(4*i) + 3] = -_v;
-    }
-
-    float y = -_v;
-    for (int i = width_minus_1; i < height_minus_1 + width_minus_1; i++) {
-        y += _minor_grid_mark_distance;
-        minor_gridmarks[4*i] =        _h;
-        minor_gridmarks[(4*i) + 1] =  y;
-        minor_gridmarks[(4*i) + 2] = -_h;
-        minor_gridmarks[(4*i) + 3] =  y;
-    }
-
-    _minor_grid_indices_size = minor_grid_total_verts / 2;
-    uint32_t minor_grid_indices[_minor_grid_indices_size];
-    for (int i = 0; i < _minor_grid_indices_size; i++)
-        minor_grid_indices[i] = i;
-
-    x = -_h;
-    for (int i = 0; i < (width_minus_1 / 10); i++) {
-        x += major_grid_mark_distance;
-        // four points, forming a line when drawn as a long rectangle
-        major_gridmarks[8*i]       = x; // - normal
-        major_gridmarks[(8*i) + 1] = _v;
-        major_gridmarks[(8*i) + 2] = x; // - normal
-        major_gridmarks[(8*i) + 3] = -_v;
-        major_gridmarks[(8*i) + 4] = x; // + normal
-        major_gridmarks[(8*i) + 5] = _v;
-        major_gridmarks[(8*i) + 6] = x; // + normal
-        major_gridmarks[(8*i) + 7] = -_v;
-    }
-
-    y = -_v;
-    for (int i = (width_minus_1 / 10); i < (height_minus_1 / 10) + (width_minus_1 / 10); i++) {
-        y += major_grid_mark_distance;
-        major_gridmarks[8*i]       = _h;
-        major_gridmarks[(8*i) + 1] = y;
-        major_gridmarks[(8*i) + 2] = -_h;
-        major_gridmarks[(8*i) + 3] = y;
-        major_gridmarks[(8*i) + 4] = _h;
-        major_gridmarks[(8*i) + 5] = y;
-        major_gridmarks[(8*i) + 6] = -_h;
-        major_gridmarks[(8*i) + 7] = y;
-    }
-
-    _major_grid_indices_size = (major_grid_total_verts / 8) * 6;
-    uint32_t major_grid_indices[_major_grid_indices_size];
-    int i = 0;
-    for (int j = 0; j < major_grid_total_verts / 2; j+=4) {
-        major_grid_indices[6*i]       = j + 0;
-        major_grid_indices[(6*i) + 1] = j + 1;
-        major_grid_indices[(6*i) + 2] = j + 2;
-        major_grid_indices[(6*i) + 3] = j + 2;
-        major_grid_indices[(6*i) + 4] = j + 1;
-        major_grid_indices[(6*i) + 5] = j + 3;
-        i++;
-    };
-
-    int major_gridmark_corner_size = major_grid_total_verts / 2;
-    uint32_t major_gridmark_corner[major_gridmark_corner_size];
-    for (int i = 0; i < major_grid_total_vertical_verts / 8; i++) {
-        major_gridmark_corner[(4*i)]     = 0;
-        major_gridmark_corner[(4*i) + 1] = 1;
-        major_gridmark_corner[(4*i) + 2] = 2;
-        major_gridmark_corner[(4*i) + 3] = 3;
-    }
-    for (int i = major_grid_total_vertical_verts / 8; i < major_gridmark_corner_size / 4; i++) {
-        major_gridmark_corner[(4*i)]     = 4;
-        major_gridmark_corner[(4*i) + 1] = 5;
-        major_gridmark_corner[(4*i) + 2] = 6;
-        major_gridmark_corner[(4*i) + 3] = 7;
-    }
+    _grid_shader->set_buffer("position", VariableType::Float32, {4, 3}, _position);
+    _grid_shader->set_buffer("tex", VariableType::Float32, {4, 2}, tex);
+    _grid_shader->set_buffer("indices", VariableType::UInt32, {3*2}, indices);
+    _grid_shader->set_uniform("canvas_size", Vector2f(width, height));
 
     float minor_color[4] = {0.5f, 0.5f, 0.5f, 1.f};
     float major_color[4] = {0.f, 0.f, 0.f, 1.f};
+    _grid_shader->set_buffer("minor_colour", VariableType::Float32, {4}, minor_color);
+    _grid_shader->set_buffer("major_colour", VariableType::Float32, {4}, major_color);
 
-    if (minor_grid_total_verts > 0) {
-        _minor_grid_shader->set_buffer("position", VariableType::Float32, {(size_t)(minor_grid_total_verts) / 2, 2}, minor_gridmarks);
-        _minor_grid_shader->set_buffer("indices", VariableType::UInt32, {(size_t)_minor_grid_indices_size}, minor_grid_indices);
-        _minor_grid_shader->set_buffer("colour", VariableType::Float32, {4}, minor_color);
-    }
-
-    if (major_grid_total_verts > 0) {
-        _major_grid_shader->set_buffer("position", VariableType::Float32, {(size_t)(major_grid_total_verts) / 2, 2}, major_gridmarks);
-        _major_grid_shader->set_buffer("indices", VariableType::UInt32, {(size_t)_major_grid_indices_size}, major_grid_indices);
-        _major_grid_shader->set_buffer("corner", VariableType::UInt32, {(size_t)major_gridmark_corner_size}, major_gridmark_corner);
-        _major_grid_shader->set_buffer("colour", VariableType::Float32, {4}, major_color);
-    }
+    _minor_grid_mark_distance = 2.f / (float)std::max(width, height); // ndc space is 2.f long in the axis that is largest
 
     update_backstitch_buffers();
     _drawing = true;
@@ -273,6 +176,8 @@ void create_line_vertices(Vector2f start, Vector2f end, Vector2f normal_vector,
 }
 
 void CanvasRenderer::update_backstitch_buffers() {
+    PROFILE_SCOPE("update backstitch buffers");
+    _app->redraw();
     std::vector<BackStitch> *backstitches = &_app->_project->backstitches;
     int no_backstitches = backstitches->size();
     int no_circle_verts = 50;
@@ -320,6 +225,8 @@ void CanvasRenderer::clear_ghost_backstitch() {
 }
 
 void CanvasRenderer::move_ghost_backstitch(Vector2f end, Thread *thread) {
+    PROFILE_SCOPE("move ghost backstitch");
+    _app->redraw();
     Vector2f start = _app->_previous_backstitch_point;
     if (end == NO_SUBSTITCH_SELECTED || start == NO_SUBSTITCH_SELECTED) {
         _backstitch_ghost_indices_size = 0;
@@ -361,19 +268,27 @@ void CanvasRenderer::move_ghost_backstitch(Vector2f end, Thread *thread) {
 }
 
 Vector2i CanvasRenderer::get_mouse_position() {
+    return get_stitch_at(_app->mouse_pos());
+}
+
+Vector2f CanvasRenderer::get_mouse_subposition() {
+    return get_substitch_at(_app->mouse_pos());
+}
+
+Vector2i CanvasRenderer::get_stitch_at(Vector2i screen_position) {
     Vector4f bounds = _camera->canvas_bounds(_position);
     try {
-        Vector2f mouse_ndc = _camera->screen_to_ndc(_app->mouse_pos());
+        Vector2f mouse_ndc = _camera->screen_to_ndc(screen_position);
         return _camera->ndc_to_stitch(mouse_ndc, bounds);
     } catch (std::invalid_argument&) {
         return NO_STITCH_SELECTED;
     }
 }
 
-Vector2f CanvasRenderer::get_mouse_subposition() {
+Vector2f CanvasRenderer::get_substitch_at(Vector2i screen_position) {
     Vector4f bounds = _camera->canvas_bounds(_position);
     try {
-        Vector2f mouse_ndc = _camera->screen_to_ndc(_app->mouse_pos());
+        Vector2f mouse_ndc = _camera->screen_to_ndc(screen_position);
         return _camera->ndc_to_substitch(mouse_ndc, bounds);
     } catch (std::invalid_argument&) {
         return NO_SUBSTITCH_SELECTED;
@@ -381,6 +296,8 @@ Vector2f CanvasRenderer::get_mouse_subposition() {
 }
 
 void CanvasRenderer::upload_texture() {
+    PROFILE_SCOPE("upload texture");
+    _app->redraw();
     _texture->upload(_app->_project->texture_data_array.get());
 }
 
@@ -388,6 +305,7 @@ void CanvasRenderer::render() {
     if (!_drawing)
         return;
 
+    PROFILE_SCOPE("render canvas");
     Vector2i device_size = _app->framebuffer_size();
     _render_pass->resize(device_size);
 
@@ -397,19 +315,12 @@ void CanvasRenderer::render() {
     if (_backstitch_ghost_indices_size != 0 && _selected_sub_stitch == NO_SUBSTITCH_SELECTED || _app->_selected_tool != ToolOptions::BACK_STITCH)
         clear_ghost_backstitch();
 
-    float pixel_canvas_height = _canvas_height_ndc * _camera->get_scale() * (float)(device_size[1]) / _app->pixel_ratio();
-    float minor_grid_mark_pixel_distance = pixel_canvas_height * _minor_grid_mark_distance;
-
     Matrix4f mvp = _camera->generate_matrices();
 
     _render_pass->begin();
 
-    // 20.f is a better value, but the gridmark stretching is more apparent when in fullscreen
     render_cs_shader(mvp);
-    if (minor_grid_mark_pixel_distance >= 30.f) {
-        render_minor_grid_shader(mvp);
-        render_major_grid_shader(mvp);
-    }
+    render_grid_shader(mvp);
     render_back_stitch_shader(mvp);
     render_back_stitch_ghost_shader(mvp);
 
@@ -420,6 +331,8 @@ void CanvasRenderer::render_cs_shader(Matrix4f mvp) {
     if (_cross_stitch_shader == nullptr)
         return;
 
+    PROFILE_SCOPE("render cross stitches");
+
     _cross_stitch_shader->set_uniform("mvp", mvp);
 
     _cross_stitch_shader->begin();
@@ -427,40 +340,25 @@ void CanvasRenderer::render_cs_shader(Matrix4f mvp) {
     _cross_stitch_shader->end();
 };
 
-void CanvasRenderer::render_minor_grid_shader(Matrix4f mvp) {
-    if (_minor_grid_shader == nullptr || _minor_grid_indices_size == 0)
-        return;
-
-    _minor_grid_shader->set_uniform("mvp", mvp);
-
-    _minor_grid_shader->begin();
-    _minor_grid_shader->draw_array(Shader::PrimitiveType::Line, 0,
-                                   _minor_grid_indices_size, true);
-    _minor_grid_shader->end();
-}
-
-void CanvasRenderer::render_major_grid_shader(Matrix4f mvp) {
-    if (_major_grid_shader == nullptr || _major_grid_indices_size == 0)
+void CanvasRenderer::render_grid_shader(Matrix4f mvp) {
+    if (_grid_shader == nullptr)
         return;
 
-    // find distance in ortho ndc of a pixel
-    Vector2f p1 = _camera->screen_to_ndc(Vector2i(0, 0));
-    Vector2f p2 = _camera->screen_to_ndc(Vector2i(0, 1));
-    float normal = p2[1] - p1[1];
+    PROFILE_SCOPE("render grid");
 
-    _major_grid_shader->set_uniform("normal", normal);
-    _major_grid_shader->set_uniform("mvp", mvp);
+    _grid_shader->set_uniform("mvp", mvp);
 
-    _major_grid_shader->begin();
-    _major_grid_shader->draw_array(Shader::PrimitiveType::Triangle, 0,
-                                   _major_grid_indices_size, true);
-    _major_grid_shader->end();
+    _grid_shader->begin();
+    _grid_shader->draw_array(Shader::PrimitiveType::Triangle, 0, 6, true);
+    _grid_shader->end();
 }
 
 void CanvasRenderer::render_back_stitch_shader(Matrix4f mvp) {
     if (_back_stitch_shader == nullptr || _backstitch_indices_size == 0)
         return;
 
+    PROFILE_SCOPE("render backstitches");
+
     _back_stitch_shader->set_uniform("mvp", mvp);
 
     _back_stitch_shader->begin();
@@ -473,6 +371,8 @@ void CanvasRenderer::render_back_stitch_ghost_shader(Matrix4f mvp) {
     if (_back_stitch_ghost_shader == nullptr || _backstitch_ghost_indices_size == 0)
         return;
 
+    PROFILE_SCOPE("render ghost backstitch");
+
     _back_stitch_ghost_shader->set_uniform("mvp", mvp);
 
     _back_stitch_ghost_shader->begin();
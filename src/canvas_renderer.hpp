@@ -17,6 +17,9 @@ public:
     void move_ghost_backstitch(nanogui::Vector2f end, Thread *thread);
     void upload_texture();
     void render();
+    // The stitch or substitch under a point on the screen, or NO_STITCH_SELECTED / NO_SUBSTITCH_SELECTED
+    nanogui::Vector2i get_stitch_at(nanogui::Vector2i screen_position);
+    nanogui::Vector2f get_substitch_at(nanogui::Vector2i screen_position);
 
     std::unique_ptr<Camera2D> _camera;
     float _position[3*4];
@@ -28,8 +31,7 @@ private:
     nanogui::Vector2i get_mouse_position();
     nanogui::Vector2f get_mouse_subposition();
     void render_cs_shader(nanogui::Matrix4f mvp);
-    void render_minor_grid_shader(nanogui::Matrix4f mvp);
-    void render_major_grid_shader(nanogui::Matrix4f mvp);
+    void render_grid_shader(nanogui::Matrix4f mvp);
     void render_back_stitch_shader(nanogui::Matrix4f mvp);
     void render_back_stitch_ghost_shader(nanogui::Matrix4f mvp);
 
@@ -37,16 +39,12 @@ private:
 
     std::unique_ptr<nanogui::RenderPass> _render_pass;
     std::unique_ptr<nanogui::Shader> _cross_stitch_shader;
-    std::unique_ptr<nanogui::Shader> _minor_grid_shader;
-    std::unique_ptr<nanogui::Shader> _major_grid_shader;
+    std::unique_ptr<nanogui::Shader> _grid_shader;
     std::unique_ptr<nanogui::Shader> _back_stitch_shader;
     std::unique_ptr<nanogui::Shader> _back_stitch_ghost_shader;
     std::unique_ptr<nanogui::Texture> _texture;
 
-    float _canvas_height_ndc;
     float _minor_grid_mark_distance;
-    int _major_grid_indices_size = 0;
-    int _minor_grid_indices_size = 0;
     int _backstitch_indices_size = 0;
     int _backstitch_ghost_indices_size = 0;
     float _h = 1.f;
@@ -80,62 +78,6 @@ const std::string BACK_STITCH_FRAG = R"(
     }
 )";
 
-const std::string MINOR_GRID_VERT = R"(
-    #version 330 core
-    layout (location = 0) in vec2 position;
-
-    uniform mat4 mvp;
-
-    void main() {
-        gl_Position = mvp * vec4(position, 0.0, 1.0);
-    }
-)";
-const std::string MINOR_GRID_FRAG = R"(
-    #version 330 core
-    out vec4 FragColor;
-
-    uniform vec4 colour;
-
-    void main() {
-        FragColor = colour;
-    }
-)";
-
-const std::string MAJOR_GRID_VERT = R"(
-    #version 330 core
-    layout (location = 0) in vec2 position;
-    layout (location = 1) in uint corner;
-
-    uniform mat4 mvp;
-    uniform float normal;
-
-    void main() {
-        vec4 pos = mvp * vec4(position, 0.0, 1.0);
-
-        if (corner == 0U || corner == 1U) {
-            pos.x -= normal;
-        } else if (corner == 2U || corner == 3U) {
-            pos.x += normal;
-        } else if (corner == 4U || corner == 5U) {
-            pos.y -= normal;
-        } else if (corner == 6U || corner == 7U) {
-            pos.y += normal;
-        }
-
-        gl_Position = pos;
-    }
-)";
-const std::string MAJOR_GRID_FRAG = R"(
-    #version 330 core
-    out vec4 FragColor;
-
-    uniform vec4 colour;
-
-    void main() {
-        FragColor = colour;
-    }
-)";
-
 const std::string CROSS_STITCH_VERT = R"(
     #version 330 core
     layout (location = 0) in vec3 position;
@@ -161,6 +103,49 @@ const std::string CROSS_STITCH_FRAG = R"(
         FragColor = texture(cross_stitch_texture, textureCoord);
     }
 )";
+
+// Grid lines are found for each pixel of the canvas from the stitch under it, as a thin line between
+// every stitch and a thicker one every 10. Their width is in pixels and they are anti-aliased, and
+// they fade out as they get too close together to tell apart. Uses the cross stitch vertex shader.
+const std::string GRID_FRAG = R"(
+    #version 330 core
+    in vec2 textureCoord;
+    out vec4 FragColor;
+
+    uniform vec2 canvas_size;
+    uniform vec4 minor_colour;
+    uniform vec4 major_colour;
+
+    // Line widths, and the distances between lines they fade out over, in pixels
+    #define MINOR_WIDTH 1.0
+    #define MAJOR_WIDTH 2.0
+    #define FADE_START 8.0
+    #define FADE_END 20.0
+
+    // How much of the pixel is covered by the nearest line of a grid with lines every spacing
+    // stitches, leaving out the lines along the edges of the canvas
+    float line_coverage(vec2 stitch, vec2 stitches_per_pixel, float spacing, float width) {
+        vec2 nearest = floor((stitch / spacing) + 0.5) * spacing;
+        vec2 pixels = abs(stitch - nearest) / stitches_per_pixel;
+        vec2 coverage = clamp((width * 0.5) + 0.5 - pixels, 0.0, 1.0);
+        coverage *= step(vec2(0.5), nearest) * step(nearest, canvas_size - 0.5);
+        return max(coverage.x, coverage.y);
+    }
+
+    void main() {
+        vec2 stitch = textureCoord * canvas_size;
+        vec2 stitches_per_pixel = max(fwidth(stitch), vec2(1e-6));
+        float pixels_per_stitch = 1.0 / max(stitches_per_pixel.x, stitches_per_pixel.y);
+
+        float minor = line_coverage(stitch, stitches_per_pixel, 1.0, MINOR_WIDTH) * smoothstep(FADE_START, FADE_END, pixels_per_stitch);
+        float major = line_coverage(stitch, stitches_per_pixel, 10.0, MAJOR_WIDTH) * smoothstep(FADE_START, FADE_END, pixels_per_stitch * 10.0);
+
+        // Major lines are drawn over the minor ones
+        float alpha = major + (minor * (1.0 - major));
+        vec3 colour = (major_colour.rgb * major) + (minor_colour.rgb * minor * (1.0 - major));
+        FragColor = vec4(colour / max(alpha, 1e-6), alpha);
+    }
+)";
 #elif defined(NANOGUI_USE_GLES)
 const std::string BACK_STITCH_VERT = R"(
     precision highp float;
@@ -185,58 +170,6 @@ const std::string BACK_STITCH_FRAG = R"(
     }
 )";
 
-const std::string MINOR_GRID_VERT = R"(
-    precision highp float;
-    attribute vec2 position;
-
-    uniform mat4 mvp;
-
-    void main() {
-        gl_Position = mvp * vec4(position, 0.0, 1.0);
-    }
-)";
-const std::string MINOR_GRID_FRAG = R"(
-    precision highp float;
-    uniform vec4 colour;
-
-    void main() {
-        gl_FragColor = colour;
-    }
-)";
-
-const std::string MAJOR_GRID_VERT = R"(
-    precision highp float;
-    attribute vec2 position;
-    attribute uint corner;
-
-    uniform float normal;
-    uniform mat4 mvp;
-
-    void main() {
-        vec4 pos = mvp * vec4(position, 0.0, 1.0);
-
-        if (corner == 0 || corner == 1) {
-            pos.x -= normal;
-        } else if (corner == 2 || corner == 3) {
-            pos.x += normal;
-        } else if (corner == 4 || corner == 5) {
-            pos.y -= normal;
-        } else if (corner == 6 || corner == 7) {
-            pos.y += normal;
-        }
-
-        gl_Position = pos;
-    }
-)";
-const std::string MAJOR_GRID_FRAG = R"(
-    precision highp float;
-    uniform vec4 colour;
-
-    void main() {
-        gl_FragColor = colour;
-    }
-)";
-
 const std::string CROSS_STITCH_VERT = R"(
     precision highp float;
     attribute vec3 position;
@@ -267,6 +200,45 @@ const std::string CROSS_STITCH_FRAG = R"(
         gl_FragColor = TEXTURE2D(cross_stitch_texture, textureCoord);
     }
 )";
+
+const std::string GRID_FRAG = R"(
+    #if __VERSION__ < 300
+    #extension GL_OES_standard_derivatives : enable
+    #endif
+
+    precision highp float;
+    varying vec2 textureCoord;
+
+    uniform vec2 canvas_size;
+    uniform vec4 minor_colour;
+    uniform vec4 major_colour;
+
+    #define MINOR_WIDTH 1.0
+    #define MAJOR_WIDTH 2.0
+    #define FADE_START 8.0
+    #define FADE_END 20.0
+
+    float line_coverage(vec2 stitch, vec2 stitches_per_pixel, float spacing, float width) {
+        vec2 nearest = floor((stitch / spacing) + 0.5) * spacing;
+        vec2 pixels = abs(stitch - nearest) / stitches_per_pixel;
+        vec2 coverage = clamp((width * 0.5) + 0.5 - pixels, 0.0, 1.0);
+        coverage *= step(vec2(0.5), nearest) * step(nearest, canvas_size - 0.5);
+        return max(coverage.x, coverage.y);
+    }
+
+    void main() {
+        vec2 stitch = textureCoord * canvas_size;
+        vec2 stitches_per_pixel = max(fwidth(stitch), vec2(1e-6));
+        float pixels_per_stitch = 1.0 / max(stitches_per_pixel.x, stitches_per_pixel.y);
+
+        float minor = line_coverage(stitch, stitches_per_pixel, 1.0, MINOR_WIDTH) * smoothstep(FADE_START, FADE_END, pixels_per_stitch);
+        float major = line_coverage(stitch, stitches_per_pixel, 10.0, MAJOR_WIDTH) * smoothstep(FADE_START, FADE_END, pixels_per_stitch * 10.0);
+
+        float alpha = major + (minor * (1.0 - major));
+        vec3 colour = (major_colour.rgb * major) + (minor_colour.rgb * minor * (1.0 - major));
+        gl_FragColor = vec4(colour / max(alpha, 1e-6), alpha);
+    }
+)";
 #elif defined(NANOGUI_USE_METAL)
 const std::string BACK_STITCH_VERT = R"(
     using namespace metal;
@@ -298,104 +270,73 @@ const std::string BACK_STITCH_FRAG = R"(
     }
 )";
 
-const std::string MINOR_GRID_VERT = R"(
+const std::string CROSS_STITCH_VERT = R"(
     using namespace metal;
     struct VertexOut {
         float4 position [[position]];
+        float2 tex;
     };
 
-    vertex VertexOut vertex_main(const device packed_float2 *position,
+    vertex VertexOut vertex_main(const device packed_float3 *position,
+                                 const device float2 *tex,
                                  constant float4x4 &mvp,
                                  uint id [[vertex_id]]) {
         VertexOut vert;
-        vert.position = mvp * float4(position[id], 0.f, 1.f);
+        vert.position = mvp * float4(position[id], 1.f);
+        vert.tex = tex[id];
         return vert;
     }
 )";
-const std::string MINOR_GRID_FRAG = R"(
+const std::string CROSS_STITCH_FRAG = R"(
     using namespace metal;
 
     struct VertexOut {
         float4 position [[position]];
+        float2 tex;
     };
 
     fragment float4 fragment_main(VertexOut vert [[stage_in]],
-                                  constant float4 &colour) {
-        return colour;
+                                  texture2d<float, access::sample> cross_stitch_texture,
+                                  sampler cross_stitch_sampler) {
+        return cross_stitch_texture.sample(cross_stitch_sampler, vert.tex);
     }
 )";
 
-const std::string MAJOR_GRID_VERT = R"(
+const std::string GRID_FRAG = R"(
     using namespace metal;
-    struct VertexOut {
-        float4 position [[position]];
-    };
-
-    vertex VertexOut vertex_main(const device packed_float2 *position,
-                                 const device uint32_t *corner,
-                                 constant float &normal,
-                                 constant float4x4 &mvp,
-                                 uint id [[vertex_id]]) {
-        float4 pos = mvp * float4(position[id], 0.f, 1.f);
-
-        if (corner[id] == 0 || corner[id] == 1) {
-            pos.x -= normal;
-        } else if (corner[id] == 2 || corner[id] == 3) {
-            pos.x += normal;
-        } else if (corner[id] == 4 || corner[id] == 5) {
-            pos.y -= normal;
-        } else if (corner[id] == 6 || corner[id] == 7) {
-            pos.y += normal;
-        }
 
-        VertexOut vert;
-        vert.position = pos;
-        return vert;
-    }
-)";
-// TODO: AntiAliasing!!
-const std::string MAJOR_GRID_FRAG = R"(
-    using namespace metal;
-
-    struct VertexOut {
-        float4 position [[position]];
-    };
-
-    fragment float4 fragment_main(VertexOut vert [[stage_in]],
-                                  constant float4 &colour) {
-        return colour;
-    }
-)";
-
-const std::string CROSS_STITCH_VERT = R"(
-    using namespace metal;
     struct VertexOut {
         float4 position [[position]];
         float2 tex;
     };
 
-    vertex VertexOut vertex_main(const device packed_float3 *position,
-                                 const device float2 *tex,
-                                 constant float4x4 &mvp,
-                                 uint id [[vertex_id]]) {
-        VertexOut vert;
-        vert.position = mvp * float4(position[id], 1.f);
-        vert.tex = tex[id];
-        return vert;
+    #define MINOR_WIDTH 1.f
+    #define MAJOR_WIDTH 2.f
+    #define FADE_START 8.f
+    #define FADE_END 20.f
+
+    float line_coverage(float2 stitch, float2 stitches_per_pixel, float spacing, float width, float2 canvas_size) {
+        float2 nearest = floor((stitch / spacing) + 0.5f) * spacing;
+        float2 pixels = abs(stitch - nearest) / stitches_per_pixel;
+        float2 coverage = clamp((width * 0.5f) + 0.5f - pixels, 0.f, 1.f);
+        coverage *= step(float2(0.5f), nearest) * step(nearest, canvas_size - 0.5f);
+        return max(coverage.x, coverage.y);
     }
-)";
-const std::string CROSS_STITCH_FRAG = R"(
-    using namespace metal;
-
-    struct VertexOut {
-        float4 position [[position]];
-        float2 tex;
-    };
 
     fragment float4 fragment_main(VertexOut vert [[stage_in]],
-                                  texture2d<float, access::sample> cross_stitch_texture,
-                                  sampler cross_stitch_sampler) {
-        return cross_stitch_texture.sample(cross_stitch_sampler, vert.tex);
+                                  constant float2 &canvas_size,
+                                  constant float4 &minor_colour,
+                                  constant float4 &major_colour) {
+        float2 stitch = vert.tex * canvas_size;
+        float2 stitches_per_pixel = max(fwidth(stitch), float2(1e-6f));
+        float pixels_per_stitch = 1.f / max(stitches_per_pixel.x, stitches_per_pixel.y);
+
+        float minor = line_coverage(stitch, stitches_per_pixel, 1.f, MINOR_WIDTH, canvas_size) * smoothstep(FADE_START, FADE_END, pixels_per_stitch);
+        float major = line_coverage(stitch, stitches_per_pixel, 10.f, MAJOR_WIDTH, canvas_size) * smoothstep(FADE_START, FADE_END, pixels_per_stitch * 10.f);
+
+        float alpha = major + (minor * (1.f - major));
+        float3 colour = (major_colour.rgb * major) + (minor_colour.rgb * minor * (1.f - major));
+        return float4(colour / max(alpha, 1e-6f), alpha);
     }
 )";
 #endif
\ No newline at end of file
@@ -0,0 +1,425 @@
+#include "catalogue.hpp"
+#include "paths.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <fmt/core.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define CATALOGUE_MMAP
+#endif
+
+static const char CATALOGUE_MAGIC[4] = {'X', 'S', 'T', 'C'};
+
+namespace {
+
+/* A compiled catalogue is a header, then one record per thread, then every string the records
+refer to. Strings are stored once however many threads use them, and aren't null terminated. */
+struct CatalogueHeader {
+    char magic[4];
+    uint32_t version;
+    // Of the XML the catalogue was compiled from
+    int64_t xml_mtime;
+    uint64_t xml_size;
+    uint64_t xml_hash;
+    uint32_t thread_count;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t strings_size;
+};
+
+struct CatalogueRecord {
+    uint32_t number_offset;
+    uint32_t number_length;
+    uint32_t description_offset;
+    uint32_t description_length;
+    Lab lab;
+    uint8_t R;
+    uint8_t G;
+    uint8_t B;
+    uint8_t padding;
+};
+
+static_assert(std::is_trivially_copyable_v<CatalogueHeader> && std::is_trivially_copyable_v<CatalogueRecord>);
+
+// A read only view of a whole file, memory mapped where the platform allows it
+class MappedFile {
+public:
+    MappedFile(const std::string& path) {
+#if defined(CATALOGUE_MMAP)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return;
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                _data = (const unsigned char*)mapping;
+                _size = info.st_size;
+            }
+        }
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return;
+
+        _buffer.resize(file.tellg());
+        file.seekg(0);
+        if (file.read((char*)_buffer.data(), _buffer.size())) {
+            _data = _buffer.data();
+            _size = _buffer.size();
+        }
+#endif
+    };
+
+    ~MappedFile() {
+#if defined(CATALOGUE_MMAP)
+        if (_data != nullptr)
+            munmap((void*)_data, _size);
+#endif
+    };
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // nullptr if the file couldn't be read
+    const unsigned char *data() const { return _data; };
+    size_t size() const { return _size; };
+
+private:
+    const unsigned char *_data = nullptr;
+    size_t _size = 0;
+#if !defined(CATALOGUE_MMAP)
+    std::vector<unsigned char> _buffer;
+#endif
+};
+
+// FNV-1a, only used to notice that a file has changed
+uint64_t hash_bytes(const unsigned char *data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// The header of file if it is a complete compiled catalogue in the current format, otherwise nullptr
+const CatalogueHeader* compiled_header(const MappedFile& file) {
+    if (file.data() == nullptr || file.size() < sizeof(CatalogueHeader))
+        return nullptr;
+
+    const CatalogueHeader *header = (const CatalogueHeader*)file.data();
+    if (!std::equal(header->magic, header->magic + 4, CATALOGUE_MAGIC) || header->version != CATALOGUE_VERSION)
+        return nullptr;
+
+    size_t expected_size = sizeof(CatalogueHeader) + (size_t)header->thread_count * sizeof(CatalogueRecord) + header->strings_size;
+    if (file.size() != expected_size)
+        return nullptr;
+
+    return header;
+}
+
+// Creates a thread for each record of a valid compiled catalogue. Returns false, leaving catalogue
+// untouched, if any record refers to a string outside the file.
+bool read_compiled(const MappedFile& file, ThreadCatalogue *catalogue) {
+    const CatalogueHeader *header = (const CatalogueHeader*)file.data();
+    const CatalogueRecord *records = (const CatalogueRecord*)(file.data() + sizeof(CatalogueHeader));
+    const char *strings = (const char*)(records + header->thread_count);
+
+    auto in_bounds = [header](uint32_t offset, uint32_t length) {
+        return (uint64_t)offset + length <= header->strings_size;
+    };
+
+    if (!in_bounds(header->name_offset, header->name_length))
+        return false;
+    for (uint32_t i = 0; i < header->thread_count; i++) {
+        if (!in_bounds(records[i].number_offset, records[i].number_length) ||
+            !in_bounds(records[i].description_offset, records[i].description_length))
+            return false;
+    }
+
+    // The catalogue copies the strings out of the file, which is already free of repeats
+    std::vector<CatalogueEntry> entries;
+    entries.reserve(header->thread_count);
+    for (uint32_t i = 0; i < header->thread_count; i++) {
+        const CatalogueRecord& record = records[i];
+        entries.push_back(CatalogueEntry{
+            std::string_view(strings + record.number_offset, record.number_length),
+            std::string_view(strings + record.description_offset, record.description_length),
+            record.R, record.G, record.B, record.lab
+        });
+    }
+    *catalogue = ThreadCatalogue(std::string_view(strings + header->name_offset, header->name_length), std::move(entries));
+    return true;
+}
+
+void save_compiled(const std::string& path, const CatalogueHeader& xml_key, ThreadCatalogue& catalogue) {
+    std::string strings;
+    std::unordered_map<std::string_view, uint32_t> interned;
+    auto intern = [&strings, &interned](std::string_view value) {
+        auto [entry, added] = interned.try_emplace(value, strings.size());
+        if (added)
+            strings += value;
+        return entry->second;
+    };
+
+    CatalogueHeader header = xml_key;
+    std::copy(CATALOGUE_MAGIC, CATALOGUE_MAGIC + 4, header.magic);
+    header.version = CATALOGUE_VERSION;
+    header.thread_count = catalogue.size();
+    header.name_offset = intern(catalogue.manufacturer());
+    header.name_length = catalogue.manufacturer().size();
+
+    std::vector<CatalogueRecord> records;
+    records.reserve(catalogue.size());
+    for (SingleThread& thread : catalogue.threads()) {
+        std::string_view number = thread.number(ThreadPosition::FIRST);
+        std::string_view description = thread.description(ThreadPosition::FIRST);
+        CatalogueRecord record{};
+        record.number_offset = intern(number);
+        record.number_length = number.size();
+        record.description_offset = intern(description);
+        record.description_length = description.size();
+        record.lab = thread.lab;
+        record.R = thread.R;
+        record.G = thread.G;
+        record.B = thread.B;
+        records.push_back(record);
+    }
+    header.strings_size = strings.size();
+
+    // Written to a temporary file first so that another instance never maps half a catalogue
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)records.data(), records.size() * sizeof(CatalogueRecord));
+        file.write(strings.data(), strings.size());
+        if (!file)
+            return;
+    }
+
+    std::error_code err;
+    std::filesystem::rename(temp_path, path, err);
+    if (err)
+        std::cout << "Unable to cache thread catalogue: " << err.message() << std::endl;
+}
+
+// Records the XML's new modification time after its contents were found to be unchanged, so the
+// next load can skip hashing it
+void update_compiled_mtime(const std::string& path, int64_t xml_mtime) {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(offsetof(CatalogueHeader, xml_mtime));
+    file.write((const char*)&xml_mtime, sizeof(xml_mtime));
+}
+
+}
+
+ThreadCatalogue::ThreadCatalogue(std::string_view manufacturer, std::vector<CatalogueEntry> entries) {
+    auto by_number = [](const CatalogueEntry& e1, const CatalogueEntry& e2) { return e1.number < e2.number; };
+    std::stable_sort(entries.begin(), entries.end(), by_number);
+
+    // Keep the last of any threads with the same number, as loading them into a map would
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (kept > 0 && entries[kept - 1].number == entries[i].number)
+            kept--;
+        if (kept != i)
+            entries[kept] = entries[i];
+        kept++;
+    }
+    entries.erase(entries.begin() + kept, entries.end());
+
+    // Work out where each string goes in the table, storing each distinct string once. Full names
+    // are all different, so they are given space without looking them up.
+    std::unordered_map<std::string_view, size_t> offsets;
+    size_t table_size = 0;
+    auto place = [&offsets, &table_size](std::string_view value) {
+        auto [offset, added] = offsets.try_emplace(value, table_size);
+        if (added)
+            table_size += value.size();
+        return offset->second;
+    };
+    struct Placed {size_t number; size_t description; size_t full_name;};
+    std::vector<Placed> placed;
+    placed.reserve(entries.size());
+    size_t manufacturer_offset = place(manufacturer);
+    for (const CatalogueEntry& entry : entries) {
+        placed.push_back(Placed{place(entry.number), place(entry.description), table_size});
+        table_size += manufacturer.size() + 1 + entry.number.size();
+    }
+
+    _strings = std::make_unique<char[]>(table_size);
+    char *table = _strings.get();
+    for (const auto& [value, offset] : offsets)
+        std::memcpy(table + offset, value.data(), value.size());
+
+    _manufacturer = std::string_view(table + manufacturer_offset, manufacturer.size());
+    _threads.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        const CatalogueEntry& entry = entries[i];
+        // The full name is the manufacturer and number separated by a space
+        char *full_name = table + placed[i].full_name;
+        std::memcpy(full_name, manufacturer.data(), manufacturer.size());
+        full_name[manufacturer.size()] = ' ';
+        std::memcpy(full_name + manufacturer.size() + 1, entry.number.data(), entry.number.size());
+
+        _threads.emplace_back(_manufacturer,
+            std::string_view(table + placed[i].number, entry.number.size()),
+            std::string_view(table + placed[i].description, entry.description.size()),
+            std::string_view(full_name, manufacturer.size() + 1 + entry.number.size()),
+            entry.R, entry.G, entry.B, entry.lab);
+    }
+
+    _labs.reserve(_threads.size());
+    _ids.reserve(_threads.size());
+    for (ThreadId id = 0; id < _threads.size(); id++) {
+        SingleThread& thread = _threads[id];
+        _labs.push_back(thread.lab);
+        _ids.emplace(thread.number(), id);
+    }
+}
+
+ThreadId ThreadCatalogue::find(std::string_view number) const {
+    auto id = _ids.find(number);
+    return id == _ids.end() ? INVALID_THREAD_ID : id->second;
+}
+
+std::string compiled_catalogue_path(const char *xml_path) {
+    std::error_code err;
+    std::string absolute_path = std::filesystem::absolute(xml_path, err).string();
+    uint64_t path_hash = hash_bytes((const unsigned char*)absolute_path.data(), absolute_path.size());
+    return get_cache_dir() + fmt::format("/catalogue_{}_{:016x}.bin", std::filesystem::path(xml_path).stem().string(), path_hash);
+}
+
+void load_catalogue(const char *xml_path, ThreadCatalogue *catalogue) {
+    std::error_code err;
+    auto mtime = std::filesystem::last_write_time(xml_path, err);
+    uintmax_t size = err ? 0 : std::filesystem::file_size(xml_path, err);
+    if (err)
+        throw std::runtime_error(fmt::format("Failed to open {}", xml_path));
+
+    CatalogueHeader xml_key{};
+    xml_key.xml_mtime = mtime.time_since_epoch().count();
+    xml_key.xml_size = size;
+
+    std::string path = compiled_catalogue_path(xml_path);
+    bool mtime_changed = false;
+    {
+        MappedFile compiled(path);
+        const CatalogueHeader *header = compiled_header(compiled);
+        if (header != nullptr && header->xml_size == xml_key.xml_size) {
+            bool valid = header->xml_mtime == xml_key.xml_mtime;
+            if (!valid) {
+                // The file may only have been touched, e.g. by being copied or checked out again
+                MappedFile xml(xml_path);
+                valid = xml.data() != nullptr && hash_bytes(xml.data(), xml.size()) == header->xml_hash;
+                mtime_changed = valid;
+            }
+
+            if (valid && read_compiled(compiled, catalogue)) {
+                if (mtime_changed)
+                    update_compiled_mtime(path, xml_key.xml_mtime);
+                return;
+            }
+        }
+    }
+
+    std::vector<ParsedThread> parsed;
+    std::string name = load_manufacturer(xml_path, &parsed);
+    std::vector<CatalogueEntry> entries;
+    entries.reserve(parsed.size());
+    for (const ParsedThread& thread : parsed)
+        entries.push_back(CatalogueEntry{thread.number, thread.description, thread.R, thread.G, thread.B, rgb_to_oklab(thread.R, thread.G, thread.B)});
+    ThreadCatalogue loaded(name, std::move(entries));
+
+    MappedFile xml(xml_path);
+    if (xml.data() != nullptr && xml.size() == xml_key.xml_size) {
+        xml_key.xml_hash = hash_bytes(xml.data(), xml.size());
+        save_compiled(path, xml_key, loaded);
+    }
+
+    *catalogue = std::move(loaded);
+}
+
+CatalogueDirectory::CatalogueDirectory(const std::string& directory) {
+    std::vector<std::pair<std::string, std::string>> found;
+    std::error_code err;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, err)) {
+        if (entry.path().extension() == ".xml")
+            found.emplace_back(entry.path().stem().string(), entry.path().string());
+    }
+    std::sort(found.begin(), found.end());
+
+    for (const auto& [name, path] : found) {
+        _indices[name] = _names.size();
+        _names.push_back(name);
+        _catalogues.push_back(std::make_unique<Catalogue>());
+        _catalogues.back()->path = path;
+    }
+}
+
+CatalogueDirectory::~CatalogueDirectory() {
+    for (std::thread& worker : _workers)
+        worker.join();
+}
+
+ThreadCatalogue* CatalogueDirectory::catalogue(const std::string& manufacturer) {
+    auto index = _indices.find(manufacturer);
+    if (index == _indices.end())
+        return nullptr;
+
+    Catalogue *catalogue = _catalogues[index->second].get();
+    load(catalogue, manufacturer);
+    return catalogue->valid ? &catalogue->threads : nullptr;
+}
+
+SingleThread* CatalogueDirectory::find(const std::string& manufacturer, std::string_view number) {
+    ThreadCatalogue *threads = catalogue(manufacturer);
+    if (threads == nullptr)
+        return nullptr;
+
+    ThreadId id = threads->find(number);
+    return id == INVALID_THREAD_ID ? nullptr : threads->thread(id);
+}
+
+void CatalogueDirectory::load_in_background() {
+    if (!_workers.empty())
+        return;
+
+    int workers = std::min<int>(std::max(1U, std::thread::hardware_concurrency()), _catalogues.size());
+    for (int w = 0; w < workers; w++) {
+        _workers.emplace_back([this]() {
+            for (int i = _next_to_load++; i < _catalogues.size(); i = _next_to_load++)
+                load(_catalogues[i].get(), _names[i]);
+        });
+    }
+}
+
+void CatalogueDirectory::load(Catalogue *catalogue, const std::string& manufacturer) {
+    std::call_once(catalogue->loaded, [catalogue, &manufacturer]() {
+        try {
+            load_catalogue(catalogue->path.c_str(), &catalogue->threads);
+            std::string_view name = catalogue->threads.manufacturer();
+            if (name != manufacturer)
+                std::cerr << fmt::format("Thread manufacturer {} is in {}, projects using it may not open", name, catalogue->path) << std::endl;
+            catalogue->valid = true;
+        } catch (std::runtime_error& err) {
+            std::cerr << fmt::format("Could not load thread manufacturer {}: {}", manufacturer, err.what()) << std::endl;
+        }
+    });
+}
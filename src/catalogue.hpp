@@ -0,0 +1,116 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+#include "threads.hpp"
+
+// Bumped whenever the layout of compiled catalogues changes, so old caches are rebuilt
+#define CATALOGUE_VERSION 1
+
+// Position of a thread in its catalogue, which doesn't change for as long as the catalogue is loaded
+typedef uint32_t ThreadId;
+
+constexpr ThreadId INVALID_THREAD_ID = UINT32_MAX;
+
+// A thread to put in a ThreadCatalogue, its strings only need to last until the catalogue is built
+struct CatalogueEntry {
+    std::string_view number;
+    std::string_view description;
+    int R;
+    int G;
+    int B;
+    Lab lab;
+};
+
+/* One manufacturer's threads, stored contiguously in order of their numbers so that a ThreadId
+indexes every array. Their Oklab colours are also kept in an array of their own, so that searching
+by colour doesn't touch the threads themselves. Every string the threads use is stored once in the
+catalogue's string table, and the threads only hold views into it. It can't be changed once built,
+and the threads it hands out stay valid for as long as it does (including after it is moved). */
+class ThreadCatalogue {
+public:
+    ThreadCatalogue() {};
+    // If entries share a number only the last is kept
+    ThreadCatalogue(std::string_view manufacturer, std::vector<CatalogueEntry> entries);
+
+    ThreadCatalogue(const ThreadCatalogue&) = delete;
+    ThreadCatalogue& operator=(const ThreadCatalogue&) = delete;
+    ThreadCatalogue(ThreadCatalogue&&) = default;
+    ThreadCatalogue& operator=(ThreadCatalogue&&) = default;
+
+    std::string_view manufacturer() const { return _manufacturer; };
+    size_t size() const { return _threads.size(); };
+    std::vector<SingleThread>& threads() { return _threads; };
+    SingleThread* thread(ThreadId id) { return &_threads[id]; };
+    const std::vector<Lab>& labs() const { return _labs; };
+    // INVALID_THREAD_ID if there is no thread with this number
+    ThreadId find(std::string_view number) const;
+
+private:
+    // Each distinct string once, one after the other without terminators. Held by pointer so that
+    // moving the catalogue doesn't move the strings.
+    std::unique_ptr<char[]> _strings;
+    std::string_view _manufacturer;
+    std::vector<SingleThread> _threads;
+    std::vector<Lab> _labs;
+    // Keyed by views of the threads' own numbers
+    std::unordered_map<std::string_view, ThreadId> _ids;
+};
+
+/* Loads a manufacturer's threads from the XML catalogue at xml_path into catalogue, replacing
+whatever it held. Parsing the XML is slow, so the first load compiles it into a binary file in the
+cache directory. Later loads memory map that file instead, as long as the XML's modification time
+and size, or failing those its hash, still match. The compiled file interns each string once and
+stores each thread's Oklab colour. Throws std::runtime_error if the XML can't be read. */
+void load_catalogue(const char *xml_path, ThreadCatalogue *catalogue);
+
+// Where the compiled copy of the catalogue at xml_path is kept
+std::string compiled_catalogue_path(const char *xml_path);
+
+/* The thread manufacturers installed in a directory, one XML catalogue each, named after the
+manufacturer (e.g. DMC.xml). Scanning the directory doesn't read the catalogues, so it takes the
+same time however many are installed. They are loaded in parallel by load_in_background, and one
+that is needed before a worker gets to it is loaded by whoever asks for it first. The threads live
+for as long as the application does. */
+class CatalogueDirectory {
+public:
+    // A missing directory is treated as having no catalogues
+    CatalogueDirectory(const std::string& directory);
+    // Waits for the catalogues still being loaded in the background
+    ~CatalogueDirectory();
+
+    // Manufacturer names in alphabetical order
+    const std::vector<std::string>& names() const { return _names; };
+    // The threads of manufacturer, waiting for them to load if they haven't yet. nullptr if there
+    // is no such manufacturer or its catalogue couldn't be loaded.
+    ThreadCatalogue* catalogue(const std::string& manufacturer);
+    // nullptr if the thread isn't in any catalogue
+    SingleThread* find(const std::string& manufacturer, std::string_view number);
+    // Starts loading every catalogue on a pool of worker threads
+    void load_in_background();
+
+private:
+    struct Catalogue {
+        std::string path;
+        std::once_flag loaded;
+        bool valid = false;
+        ThreadCatalogue threads;
+    };
+
+    void load(Catalogue *catalogue, const std::string& manufacturer);
+
+    std::vector<std::string> _names;
+    // In the same order as _names
+    std::vector<std::unique_ptr<Catalogue>> _catalogues;
+    // Index of each manufacturer in _names
+    std::unordered_map<std::string, int> _indices;
+    std::atomic<int> _next_to_load = 0;
+    std::vector<std::thread> _workers;
+};
@@ -0,0 +1,267 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <fmt/core.h>
+
+#include "dithering.hpp"
+#include "image_source.hpp"
+#include "pdf_creation.hpp"
+#include "project.hpp"
+#include "threads.hpp"
+#include "catalogue.hpp"
+#include "paths.hpp"
+
+using namespace std::chrono;
+
+// Converts an image into a pattern without opening a window, so conversions can be run on machines
+// with no display. The pattern is saved as OXS or PDF depending on the extension of the output path.
+
+static const char *USAGE =
+    "Usage: x-stitch-cli [options] <image> <output.oxs|output.pdf>\n"
+    "\n"
+    "Options:\n"
+    "  --width <stitches>         Width of the pattern, defaults to the image width\n"
+    "  --height <stitches>        Height of the pattern, defaults to the image height\n"
+    "                             (if only one is given the other keeps the aspect ratio)\n"
+    "  --title <title>            Title of the pattern, defaults to the image's file name\n"
+    "  --background <RRGGBB>      Colour of the fabric, defaults to FFFFFF\n"
+    "  --algorithm <name>         floyd-steinburg (default), atkinson, jarvis-judice-ninke,\n"
+    "                             stucki, sierra, bayer, blue-noise or quantise\n"
+    "  --matrix-size <size>       Bayer matrix size: 2, 4 (default), 8, 16, 32 or 64\n"
+    "  --serpentine               Alternate direction on each row (error diffusion only)\n"
+    "  --max-threads <number>     Maximum number of threads in the pattern\n"
+    "  --blend                    Allow two threads to be blended in one stitch\n"
+    "  --no-refine-palette        With --max-threads, use the threads nearest to the colour\n"
+    "                             clusters without refining the choice, which is faster\n"
+    "  --resize-filter <name>     automatic (default), box, mitchell or lanczos\n"
+    "  --transparency <mode>      blend (default) with the background or cut-out\n"
+    "  --alpha-cutoff <0-255>     With cut-out, pixels less opaque than this are left blank,\n"
+    "                             defaults to 128\n"
+    "  --palette <file.xml>       Thread manufacturer to use, can be given more than once,\n"
+    "                             defaults to DMC\n"
+    "  --resources <dir>          Directory holding the fonts, symbols and thread palettes\n"
+    "  --author <name>            Author printed on the PDF\n"
+    "  --black-and-white          Render the PDF chart in black and white\n"
+    "  --help                     Show this message\n";
+
+struct Options {
+    std::string image_path;
+    std::string output_path;
+    int width = 0;
+    int height = 0;
+    std::string title;
+    std::string background = "FFFFFF";
+    DitheringSettings settings;
+    ResizeFilters resize_filter = ResizeFilters::AUTOMATIC;
+    std::vector<std::string> palette_paths;
+    std::string resources_dir;
+    std::string author = "X Stitch Editor";
+    bool black_and_white = false;
+};
+
+static int find_name(const std::string& value, const std::vector<std::string>& names, const char *option) {
+    for (int i = 0; i < names.size(); i++) {
+        if (names[i] == value)
+            return i;
+    }
+    throw std::invalid_argument(fmt::format("Unrecognised value '{}' for {}", value, option));
+}
+
+static int parse_int(const std::string& value, const char *option) {
+    size_t end;
+    int result;
+    try {
+        result = std::stoi(value, &end);
+    } catch (const std::exception&) {
+        end = 0;
+    }
+    if (end == 0 || end != value.size())
+        throw std::invalid_argument(fmt::format("{} must be a whole number", option));
+    return result;
+}
+
+// Throws std::invalid_argument if the arguments are malformed
+static Options parse_arguments(int argc, char **argv) {
+    Options options;
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+
+        if (arg == "--serpentine") {
+            options.settings.serpentine = true;
+            continue;
+        } else if (arg == "--blend") {
+            options.settings.blend_threads = true;
+            continue;
+        } else if (arg == "--no-refine-palette") {
+            options.settings.refine_palette = false;
+            continue;
+        } else if (arg == "--black-and-white") {
+            options.black_and_white = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            throw std::invalid_argument(fmt::format("{} needs a value", arg));
+        std::string value = argv[++i];
+
+        if (arg == "--width") {
+            options.width = parse_int(value, "--width");
+            if (options.width < 1)
+                throw std::invalid_argument("--width must be 1 or greater");
+        } else if (arg == "--height") {
+            options.height = parse_int(value, "--height");
+            if (options.height < 1)
+                throw std::invalid_argument("--height must be 1 or greater");
+        } else if (arg == "--title") {
+            options.title = value;
+        } else if (arg == "--background") {
+            options.background = value;
+        } else if (arg == "--algorithm") {
+            options.settings.algorithm = find_name(value, {"floyd-steinburg", "atkinson", "jarvis-judice-ninke",
+                                                           "stucki", "sierra", "bayer", "blue-noise", "quantise"}, "--algorithm");
+        } else if (arg == "--matrix-size") {
+            options.settings.bayer_order = parse_int(value, "--matrix-size");
+        } else if (arg == "--max-threads") {
+            options.settings.max_threads = parse_int(value, "--max-threads");
+            if (options.settings.max_threads < 1)
+                throw std::invalid_argument("--max-threads must be 1 or greater");
+        } else if (arg == "--resize-filter") {
+            options.resize_filter = (ResizeFilters)find_name(value, {"automatic", "box", "mitchell", "lanczos"}, "--resize-filter");
+        } else if (arg == "--transparency") {
+            options.settings.alpha_mode = find_name(value, {"blend", "cut-out"}, "--transparency");
+        } else if (arg == "--alpha-cutoff") {
+            options.settings.alpha_cutoff = parse_int(value, "--alpha-cutoff");
+            if (options.settings.alpha_cutoff < 0 || options.settings.alpha_cutoff > 255)
+                throw std::invalid_argument("--alpha-cutoff must be between 0 and 255");
+        } else if (arg == "--palette") {
+            options.palette_paths.push_back(value);
+        } else if (arg == "--resources") {
+            options.resources_dir = value;
+        } else if (arg == "--author") {
+            options.author = value;
+        } else {
+            throw std::invalid_argument(fmt::format("Unrecognised option {}", arg));
+        }
+    }
+
+    if (positional.size() != 2)
+        throw std::invalid_argument("Expected an image and an output path");
+    options.image_path = positional[0];
+    options.output_path = positional[1];
+
+    if (options.title.empty())
+        options.title = std::filesystem::path(options.image_path).stem().string();
+
+    return options;
+}
+
+// Picks whichever of width and height weren't given, keeping the aspect ratio of the image
+static void choose_size(Options *options, int image_width, int image_height) {
+    if (options->width == 0 && options->height == 0) {
+        options->width = image_width;
+        options->height = image_height;
+    } else if (options->width == 0) {
+        options->width = std::max(1, (int)std::lround((double)options->height * image_width / image_height));
+    } else if (options->height == 0) {
+        options->height = std::max(1, (int)std::lround((double)options->width * image_height / image_width));
+    }
+}
+
+static int run(Options options) {
+    if (!options.resources_dir.empty())
+        set_resources_dir(options.resources_dir);
+#if defined(X_STITCH_RESOURCES_DIR)
+    else
+        set_resources_dir(X_STITCH_RESOURCES_DIR);
+#endif
+
+    std::string extension = std::filesystem::path(options.output_path).extension().string();
+    for (char& c : extension)
+        c = std::tolower(c);
+    if (extension != ".oxs" && extension != ".pdf")
+        throw std::invalid_argument("The output must be an .oxs or .pdf file");
+
+    if (options.palette_paths.empty()) {
+        std::string resources_dir = get_resources_dir();
+        if (resources_dir == "")
+            throw std::runtime_error("Couldn't fetch resource directory");
+        options.palette_paths.push_back(resources_dir + "/catalogues/DMC.xml");
+    }
+
+    // Own the threads in palette
+    std::vector<ThreadCatalogue> catalogues;
+    std::vector<Thread*> palette;
+    for (const std::string& path : options.palette_paths) {
+        load_catalogue(path.c_str(), &catalogues.emplace_back());
+        for (SingleThread& thread : catalogues.back().threads())
+            palette.push_back(&thread);
+    }
+
+    auto start = high_resolution_clock::now();
+    std::unique_ptr<ImageSource> source = open_image(options.image_path);
+    auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    std::cout << "Time elapsed loading image: " << duration.count() << "ms" << std::endl;
+
+    choose_size(&options, source->width(), source->height());
+    Project project(options.title, options.width, options.height, hex2rgb(options.background));
+
+    start = high_resolution_clock::now();
+    std::vector<unsigned char> image((size_t)project.width * project.height * 4);
+    resize_image(source.get(), image.data(), project.width, project.height, options.resize_filter);
+    source.reset();
+    duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    std::cout << "Time elapsed resizing: " << duration.count() << "ms" << std::endl;
+
+    start = high_resolution_clock::now();
+    dither_image(options.settings, &palette, image.data(), project.width, project.height, &project);
+    duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    std::cout << "Time elapsed dithering: " << duration.count() << "ms" << std::endl;
+
+    if (extension == ".oxs") {
+        project.save(options.output_path.c_str());
+    } else {
+        PDFSettings pdf_settings{!options.black_and_white, false, options.author};
+        PDFWizard pdf_wizard(&project, &pdf_settings);
+        pdf_wizard.create_and_save_pdf(options.output_path);
+    }
+    std::cout << "Saved " << options.output_path << std::endl;
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            std::cout << USAGE;
+            return 0;
+        }
+    }
+
+    Options options;
+    try {
+        options = parse_arguments(argc, argv);
+    } catch (const std::invalid_argument& err) {
+        std::cerr << err.what() << "\n\n" << USAGE;
+        return 2;
+    }
+
+    try {
+        return run(options);
+    } catch (const std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+}
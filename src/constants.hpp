@@ -1,10 +1,7 @@
 #pragma once
 #include <nanogui/nanogui.h>
 #include <string>
-
-#ifdef __APPLE__
-#include "CoreFoundation/CoreFoundation.h"
-#endif
+#include "paths.hpp"
 
 enum ToolOptions {
     NO_SELECTION,
@@ -24,6 +21,4 @@ enum ApplicationStates {
 
 const nanogui::Vector2i NO_STITCH_SELECTED = nanogui::Vector2i(-1, -1);
 const nanogui::Vector2f NO_SUBSTITCH_SELECTED = nanogui::Vector2f(-1.f, -1.f);
-const nanogui::Color CANVAS_DEFAULT_COLOR = nanogui::Color(255, 255, 255, 255);
-
-std::string get_resources_dir();
\ No newline at end of file
+const nanogui::Color CANVAS_DEFAULT_COLOR = nanogui::Color(255, 255, 255, 255);
\ No newline at end of file
@@ -1,19 +1,43 @@
 #include "dithering.hpp"
+#include "blue_noise.hpp"
+#include "profiler.hpp"
 #include <set>
-#include <nanogui/nanogui.h>
+#include <nanogui/vector.h>
 #include <iostream>
 #include <numeric>
-#include "dkm.hpp"
 #include <tuple>
+#include <thread>
+#include <random>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 
-#define FS_ERR_RIGHT      0.4375f // 7/16
-#define FS_ERR_DOWN_LEFT  0.1875f // 3/16
-#define FS_ERR_DOWN       0.3125f // 5/16
-#define FS_ERR_DOWN_RIGHT 0.0625f // 1/16
 #define SQ_DIFF(x, y) (((x - y) * (x - y)) >> 2)
+#define KMEANS_SEED 20240229U
+#define KMEANS_MAX_ITERATIONS 100
+// Points summed together before the sums are combined, fixed so the result doesn't depend on the
+// number of workers
+#define KMEANS_CHUNK_SIZE 1024
+#define PALETTE_OPTIMISE_MAX_ITERATIONS 50
+// Furthest apart (in Oklab) two threads can be to be blended together
+#define BLEND_MAX_DISTANCE 1.0
+#define BLEND_MAX_HUE_DISTANCE 0.3
+// Number of palettes expand_palette remembers the blends of
+#define BLEND_TABLE_SIZE 8
 
 RGBcolour BLANK_COLOUR = RGBcolour{};
 
+DitheringAlgorithm::DitheringAlgorithm(std::vector<Thread*> *palette, int max_threads, bool blend_threads)
+: _palette(palette), _blend_threads(blend_threads)
+{
+    _max_threads = max_threads <= 0 ? 1 : max_threads;
+    _workers = std::max(1U, std::thread::hardware_concurrency());
+}
+
 Thread* DitheringAlgorithm::find_nearest_neighbour(RGBcolour needle, std::vector<Thread*> *palette = nullptr) {
     Thread *match = nullptr;
     bool using_default_palette = palette == nullptr;
@@ -52,116 +76,487 @@ Thread* DitheringAlgorithm::find_nearest_neighbour(RGBcolour needle, std::vector
     return match;
 };
 
-auto R_compare = [](const RGBcolour& c1, const RGBcolour& c2) { return c1.R < c2.R; };
-auto G_compare = [](const RGBcolour& c1, const RGBcolour& c2) { return c1.G < c2.G; };
-auto B_compare = [](const RGBcolour& c1, const RGBcolour& c2) { return c1.B < c2.B; };
+int DitheringAlgorithm::find_nearest_index(RGBcolour needle, std::map<RGBcolour, int> *cache) {
+    auto cached = cache->find(needle);
+    if (cached != cache->end())
+        return cached->second;
+
+    // Same weighting as find_nearest_neighbour, see there for details
+    int match = -1;
+    int minimum_distance_sq = INT_MAX;
+    for (int i = 0; i < _palette_colours.size(); i++) {
+        const RGBcolour& colour = _palette_colours[i];
+        int distance_sq = (1063 * SQ_DIFF(needle.R, colour.R) / 5000) +
+                          (7152 * SQ_DIFF(needle.G, colour.G) / 10000) +
+                          (361 * SQ_DIFF(needle.B, colour.B) / 5000);
+
+        if (distance_sq < minimum_distance_sq) {
+            minimum_distance_sq = distance_sq;
+            match = i;
+        }
+    }
+
+    (*cache)[needle] = match;
+    return match;
+}
+
+std::vector<ColourBin> DitheringAlgorithm::build_histogram(unsigned char *image, int width, int height) {
+    constexpr int CELLS = HISTOGRAM_LEVELS * HISTOGRAM_LEVELS * HISTOGRAM_LEVELS;
+    constexpr int SHIFT = 8 - HISTOGRAM_BITS;
+
+    // Each worker counts a block of rows into its own histogram, which are added together after
+    int workers = std::max(1, std::min(_workers, height / 64));
+    std::vector<std::vector<ColourBin>> partial_histograms(workers);
+
+    auto worker = [&](int n) {
+        std::vector<ColourBin>& cells = partial_histograms[n];
+        cells.assign(CELLS, ColourBin{});
+        int end = ((n + 1) * height / workers) * width;
+        for (int i = (n * height / workers) * width; i < end; i++) {
+            const unsigned char *pixel = image + (i * 4);
+            // Ignore 100% transparent pixels
+            if (pixel[3] == 0)
+                continue;
+
+            int cell = ((pixel[0] >> SHIFT) << (2 * HISTOGRAM_BITS)) | ((pixel[1] >> SHIFT) << HISTOGRAM_BITS) | (pixel[2] >> SHIFT);
+            cells[cell].count++;
+            cells[cell].sum[0] += pixel[0];
+            cells[cell].sum[1] += pixel[1];
+            cells[cell].sum[2] += pixel[2];
+        }
+    };
+
+    run_workers(workers, worker);
+
+    std::vector<ColourBin> histogram;
+    for (int cell = 0; cell < CELLS; cell++) {
+        ColourBin bin{};
+        for (const std::vector<ColourBin>& cells : partial_histograms) {
+            bin.count += cells[cell].count;
+            for (int c = 0; c < 3; c++)
+                bin.sum[c] += cells[cell].sum[c];
+        }
+        if (bin.count == 0)
+            continue;
+
+        bin.level[0] = cell >> (2 * HISTOGRAM_BITS);
+        bin.level[1] = (cell >> HISTOGRAM_BITS) & (HISTOGRAM_LEVELS - 1);
+        bin.level[2] = cell & (HISTOGRAM_LEVELS - 1);
+        histogram.push_back(bin);
+    }
+
+    return histogram;
+}
 
-void DitheringAlgorithm::median_cut(std::vector<RGBcolour> *image_arr, int depth, std::vector<RGBcolour> *points) {
-    if (image_arr->size() == 0) {
+void DitheringAlgorithm::median_cut(ColourBin *begin, ColourBin *end, int depth, std::vector<RGBcolour> *points) {
+    if (begin == end) {
         return;
     }
 
-    if (depth == 0) {
-        int R_ave = std::accumulate(image_arr->begin(), image_arr->end(), 0.0,
-                                       [](int lhs, const RGBcolour& rhs) { return lhs + rhs.R; }) / image_arr->size();
-        int G_ave = std::accumulate(image_arr->begin(), image_arr->end(), 0.0,
-                                       [](int lhs, const RGBcolour& rhs) { return lhs + rhs.G; }) / image_arr->size();
-        int B_ave = std::accumulate(image_arr->begin(), image_arr->end(), 0.0,
-                                       [](int lhs, const RGBcolour& rhs) { return lhs + rhs.B; }) / image_arr->size();
+    if (depth == 0 || end - begin == 1) {
+        int64_t count = 0;
+        int64_t sum[3] = {0, 0, 0};
+        for (ColourBin *bin = begin; bin != end; bin++) {
+            count += bin->count;
+            for (int c = 0; c < 3; c++)
+                sum[c] += bin->sum[c];
+        }
 
-        points->push_back({R_ave, G_ave, B_ave});
+        points->push_back({(int)(sum[0] / count), (int)(sum[1] / count), (int)(sum[2] / count)});
         return;
     }
 
-    auto R_max = *std::max_element(image_arr->begin(), image_arr->end(), R_compare);
-    auto G_max = *std::max_element(image_arr->begin(), image_arr->end(), G_compare);
-    auto B_max = *std::max_element(image_arr->begin(), image_arr->end(), B_compare);
-    auto R_min = *std::min_element(image_arr->begin(), image_arr->end(), R_compare);
-    auto G_min = *std::min_element(image_arr->begin(), image_arr->end(), G_compare);
-    auto B_min = *std::min_element(image_arr->begin(), image_arr->end(), B_compare);
-
-    double R_range = R_max.R - R_min.R;
-    double G_range = G_max.G - G_min.G;
-    double B_range = B_max.B - B_min.B;
-
-    int highest_range = 0;
-
-    if (R_range >= G_range && R_range >= B_range) {
-        highest_range = 0;
-    } else if (G_range >= R_range && G_range >= B_range) {
-        highest_range = 1;
-    } else if (B_range >= R_range && B_range >= G_range) {
-        highest_range = 2;
+    // Split along the channel with the highest range
+    int min_level[3] = {HISTOGRAM_LEVELS, HISTOGRAM_LEVELS, HISTOGRAM_LEVELS};
+    int max_level[3] = {-1, -1, -1};
+    int64_t total = 0;
+    for (ColourBin *bin = begin; bin != end; bin++) {
+        for (int c = 0; c < 3; c++) {
+            min_level[c] = std::min(min_level[c], bin->level[c]);
+            max_level[c] = std::max(max_level[c], bin->level[c]);
+        }
+        total += bin->count;
     }
 
-    switch (highest_range) {
-    case 0: std::sort(image_arr->begin(), image_arr->end(), R_compare);
-        break;
-    case 1: std::sort(image_arr->begin(), image_arr->end(), G_compare);
-        break;
-    case 2: std::sort(image_arr->begin(), image_arr->end(), B_compare);
-        break;
+    int channel = 0;
+    for (int c = 1; c < 3; c++) {
+        if (max_level[c] - min_level[c] > max_level[channel] - min_level[channel])
+            channel = c;
     }
-    int median_index = image_arr->size() / 2;
 
-    auto begin = image_arr->begin();
-    auto middle = begin + median_index;
-    auto end = image_arr->end();
+    // The median pixel is found by counting pixels at each level of the channel, rather than
+    // sorting. The split always leaves at least one level on each side.
+    int64_t level_counts[HISTOGRAM_LEVELS] = {};
+    for (ColourBin *bin = begin; bin != end; bin++)
+        level_counts[bin->level[channel]] += bin->count;
+
+    int64_t below = 0;
+    int split_level = max_level[channel];
+    for (int level = min_level[channel]; level < max_level[channel]; level++) {
+        below += level_counts[level];
+        if (below * 2 >= total) {
+            split_level = level + 1;
+            break;
+        }
+    }
 
-    std::vector<RGBcolour> *bucket_1 = new std::vector(begin, middle);
-    std::vector<RGBcolour> *bucket_2 = new std::vector(middle, end);
+    ColourBin *middle = std::partition(begin, end, [channel, split_level](const ColourBin& bin) {
+        return bin.level[channel] < split_level;
+    });
 
-    median_cut(bucket_1, depth - 1, points);
-    median_cut(bucket_2, depth - 1, points);
+    median_cut(begin, middle, depth - 1, points);
+    median_cut(middle, end, depth - 1, points);
+}
 
-    delete bucket_1;
-    delete bucket_2;
+// Squared euclidean distance between two colours
+static inline double distance_sq(const std::array<double, 3>& a, const std::array<double, 3>& b) {
+    double dR = a[0] - b[0];
+    double dG = a[1] - b[1];
+    double dB = a[2] - b[2];
+    return (dR * dR) + (dG * dG) + (dB * dB);
 }
 
-void DitheringAlgorithm::create_closest_palette(std::vector<RGBcolour> averages, std::vector<Thread*> *new_palette) {
-    for (auto average : averages) {
-        std::vector<Thread*> palette = *_palette;
+std::vector<RGBcolour> DitheringAlgorithm::kmeans(const std::vector<ColourBin>& histogram, int k) {
+    int n = histogram.size();
+    std::vector<std::array<double, 3>> points(n);
+    std::vector<double> weights(n);
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++)
+            points[i][c] = (double)histogram[i].sum[c] / histogram[i].count;
+        weights[i] = histogram[i].count;
+    }
+
+    // k-means++ seeding, each centre is picked with probability proportional to its weight times
+    // its squared distance from the nearest centre so far. The values from mt19937 are the same
+    // everywhere (unlike the standard distributions), so the palette is reproducible.
+    std::mt19937 rng(KMEANS_SEED);
+    std::vector<std::array<double, 3>> centres;
+    std::vector<double> nearest_sq(n, DBL_MAX);
+    // The first centre is only weighted by pixel count
+    auto probability = [&](int i) { return centres.empty() ? weights[i] : weights[i] * nearest_sq[i]; };
+    while (centres.size() < k) {
+        double total = 0.0;
+        for (int i = 0; i < n; i++)
+            total += probability(i);
+        // Every point is already a centre
+        if (total <= 0.0)
+            break;
 
-        while (true) {
-            if (palette.size() == 0)
+        double target = (rng() / 4294967296.0) * total;
+        int chosen = n - 1;
+        for (int i = 0; i < n; i++) {
+            target -= probability(i);
+            if (target < 0.0) {
+                chosen = i;
                 break;
+            }
+        }
 
-            Thread *t = find_nearest_neighbour(average, &palette);
-            bool already_in_palette = false;
-            for (Thread *pt : *new_palette) {
-                if (t == pt) {
-                    already_in_palette = true;
-                    break;
+        centres.push_back(points[chosen]);
+        for (int i = 0; i < n; i++)
+            nearest_sq[i] = std::min(nearest_sq[i], distance_sq(points[i], points[chosen]));
+    }
+    k = centres.size();
+
+    // Lloyd's algorithm with Hamerly's bounds. upper is at least the distance to the assigned
+    // centre and lower is at most the distance to any other centre, so when upper is below lower
+    // (or half the distance between the assigned centre and its nearest neighbour) the point can't
+    // have changed centre and the search is skipped. Points are split across the workers.
+    std::vector<int> assignment(n, 0);
+    std::vector<double> upper(n, DBL_MAX);
+    std::vector<double> lower(n, 0.0);
+    std::vector<double> half_gap(k);
+    std::vector<double> movement(k);
+    // Weighted sum of R, G, B and the total weight of each centre's points, per chunk of points.
+    // The chunks don't depend on the number of workers and are added up in order, so neither do
+    // the centres.
+    int chunks = (n + KMEANS_CHUNK_SIZE - 1) / KMEANS_CHUNK_SIZE;
+    int workers = std::max(1, std::min(_workers, chunks));
+    std::vector<std::vector<std::array<double, 4>>> partial_sums(chunks, std::vector<std::array<double, 4>>(k));
+    std::vector<int> partial_changes(chunks);
+
+    for (int iteration = 0; iteration < KMEANS_MAX_ITERATIONS; iteration++) {
+        for (int c = 0; c < k; c++) {
+            double nearest = DBL_MAX;
+            for (int other = 0; other < k; other++) {
+                if (other != c)
+                    nearest = std::min(nearest, distance_sq(centres[c], centres[other]));
+            }
+            half_gap[c] = 0.5 * std::sqrt(nearest);
+        }
+
+        auto assign_chunk = [&](int chunk) {
+            std::vector<std::array<double, 4>>& sums = partial_sums[chunk];
+            std::fill(sums.begin(), sums.end(), std::array<double, 4>{0.0, 0.0, 0.0, 0.0});
+            int changes = 0;
+            int end = std::min(n, (chunk + 1) * KMEANS_CHUNK_SIZE);
+            for (int i = chunk * KMEANS_CHUNK_SIZE; i < end; i++) {
+                int assigned = assignment[i];
+                double bound = std::max(half_gap[assigned], lower[i]);
+                if (upper[i] > bound) {
+                    upper[i] = std::sqrt(distance_sq(points[i], centres[assigned]));
+                    if (upper[i] > bound) {
+                        double first = DBL_MAX;
+                        double second = DBL_MAX;
+                        int best = assigned;
+                        for (int c = 0; c < k; c++) {
+                            double distance = std::sqrt(distance_sq(points[i], centres[c]));
+                            if (distance < first) {
+                                second = first;
+                                first = distance;
+                                best = c;
+                            } else if (distance < second) {
+                                second = distance;
+                            }
+                        }
+                        if (best != assigned) {
+                            assignment[i] = best;
+                            changes++;
+                        }
+                        upper[i] = first;
+                        lower[i] = second;
+                    }
                 }
+
+                std::array<double, 4>& sum = sums[assignment[i]];
+                sum[0] += weights[i] * points[i][0];
+                sum[1] += weights[i] * points[i][1];
+                sum[2] += weights[i] * points[i][2];
+                sum[3] += weights[i];
+            }
+            partial_changes[chunk] = changes;
+        };
+        // Each worker takes a contiguous block of chunks
+        run_workers(workers, [&](int w) {
+            int last_chunk = (w + 1) * chunks / workers;
+            for (int chunk = w * chunks / workers; chunk < last_chunk; chunk++)
+                assign_chunk(chunk);
+        });
+
+        int changes = 0;
+        for (int chunk = 0; chunk < chunks; chunk++)
+            changes += partial_changes[chunk];
+        if (iteration > 0 && changes == 0)
+            break;
+
+        // Move each centre to the weighted mean of its points, a centre with no points stays put
+        double largest_move = 0.0;
+        double second_largest_move = 0.0;
+        int largest_mover = -1;
+        for (int c = 0; c < k; c++) {
+            std::array<double, 4> sum = {0.0, 0.0, 0.0, 0.0};
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                for (int j = 0; j < 4; j++)
+                    sum[j] += partial_sums[chunk][c][j];
             }
 
-            if (!already_in_palette) {
-                new_palette->push_back(t);
-                break;
+            movement[c] = 0.0;
+            if (sum[3] > 0.0) {
+                std::array<double, 3> centre = {sum[0] / sum[3], sum[1] / sum[3], sum[2] / sum[3]};
+                movement[c] = std::sqrt(distance_sq(centre, centres[c]));
+                centres[c] = centre;
+            }
+
+            if (movement[c] > largest_move) {
+                second_largest_move = largest_move;
+                largest_move = movement[c];
+                largest_mover = c;
+            } else if (movement[c] > second_largest_move) {
+                second_largest_move = movement[c];
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            upper[i] += movement[assignment[i]];
+            lower[i] -= assignment[i] == largest_mover ? second_largest_move : largest_move;
+        }
+    }
+
+    std::vector<RGBcolour> means;
+    for (const std::array<double, 3>& centre : centres)
+        means.push_back(RGBcolour{(int)std::lround(centre[0]), (int)std::lround(centre[1]), (int)std::lround(centre[2])});
+    return means;
+}
+
+void DitheringAlgorithm::create_closest_palette(const std::vector<RGBcolour>& averages, std::vector<Thread*> *new_palette) {
+    std::vector<bool> taken(_palette->size(), false);
+    for (const RGBcolour& average : averages) {
+        // Same distance as find_nearest_neighbour, ties go to the earlier thread
+        int best = -1;
+        int minimum_distance_sq = INT_MAX;
+        for (int i = 0; i < _palette->size(); i++) {
+            if (taken[i])
+                continue;
+
+            Thread *colour = (*_palette)[i];
+            int distance_sq = (1063 * SQ_DIFF(average.R, colour->R) / 5000) +
+                              (7152 * SQ_DIFF(average.G, colour->G) / 10000) +
+                              (361 * SQ_DIFF(average.B, colour->B) / 5000);
+            if (distance_sq < minimum_distance_sq) {
+                minimum_distance_sq = distance_sq;
+                best = i;
+            }
+        }
+
+        // Every thread has been used
+        if (best == -1)
+            break;
+
+        taken[best] = true;
+        new_palette->push_back((*_palette)[best]);
+    }
+}
+
+// Squared distance between a colour and a thread, weighted the same way as find_nearest_neighbour
+static inline double thread_distance_sq(const std::array<double, 3>& colour, const Thread *thread) {
+    double dR = colour[0] - thread->R;
+    double dG = colour[1] - thread->G;
+    double dB = colour[2] - thread->B;
+    return (0.2126 * dR * dR) + (0.7152 * dG * dG) + (0.0722 * dB * dB);
+}
+
+void DitheringAlgorithm::optimise_palette(const std::vector<ColourBin>& histogram, std::vector<Thread*> *new_palette) {
+    int n = histogram.size();
+    int k = new_palette->size();
+    if (n == 0 || k == 0)
+        return;
+
+    std::vector<std::array<double, 3>> points(n);
+    std::vector<double> weights(n);
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++)
+            points[i][c] = (double)histogram[i].sum[c] / histogram[i].count;
+        weights[i] = histogram[i].count;
+    }
+
+    // Each slot of the reduced palette holds the index of a thread in the full palette
+    std::vector<int> chosen(k);
+    for (int s = 0; s < k; s++)
+        chosen[s] = std::find(_palette->begin(), _palette->end(), (*new_palette)[s]) - _palette->begin();
+
+    // Lloyd's algorithm where the centres can only be threads. Assigning the cells to their
+    // nearest slot gives the error of the current threads, then each slot takes the thread
+    // nearest to the weighted mean of its cells, which is the thread with the lowest error for
+    // those cells. The nearest slot and its distance are kept for every cell so that only the
+    // slots that changed thread have to be compared against afterwards.
+    std::vector<int> assignment(n, -1);
+    std::vector<double> nearest(n, DBL_MAX);
+    std::vector<bool> slot_changed(k, true);
+    std::vector<int> changed_slots(k);
+    std::iota(changed_slots.begin(), changed_slots.end(), 0);
+    int workers = std::max(1, std::min(_workers, n / 1024));
+    // Weighted sum of R, G, B and the total weight of each slot's cells, per worker
+    std::vector<std::vector<std::array<double, 4>>> partial_sums(workers, std::vector<std::array<double, 4>>(k));
+    std::vector<double> partial_error(workers);
+    std::vector<int> previous = chosen;
+    double error = DBL_MAX;
+
+    for (int iteration = 0; iteration < PALETTE_OPTIMISE_MAX_ITERATIONS && !cancelled(); iteration++) {
+        run_workers(workers, [&](int w) {
+            std::vector<std::array<double, 4>>& sums = partial_sums[w];
+            std::fill(sums.begin(), sums.end(), std::array<double, 4>{0.0, 0.0, 0.0, 0.0});
+            double worker_error = 0.0;
+            int end = (w + 1) * n / workers;
+            for (int i = w * n / workers; i < end; i++) {
+                if (assignment[i] == -1 || slot_changed[assignment[i]]) {
+                    // The thread this cell was nearest to has gone, search every slot
+                    nearest[i] = DBL_MAX;
+                    for (int s = 0; s < k; s++) {
+                        double distance = thread_distance_sq(points[i], (*_palette)[chosen[s]]);
+                        if (distance < nearest[i]) {
+                            nearest[i] = distance;
+                            assignment[i] = s;
+                        }
+                    }
+                } else {
+                    for (int s : changed_slots) {
+                        double distance = thread_distance_sq(points[i], (*_palette)[chosen[s]]);
+                        if (distance < nearest[i]) {
+                            nearest[i] = distance;
+                            assignment[i] = s;
+                        }
+                    }
+                }
+
+                worker_error += weights[i] * nearest[i];
+                std::array<double, 4>& sum = sums[assignment[i]];
+                sum[0] += weights[i] * points[i][0];
+                sum[1] += weights[i] * points[i][1];
+                sum[2] += weights[i] * points[i][2];
+                sum[3] += weights[i];
+            }
+            partial_error[w] = worker_error;
+        });
+
+        double new_error = 0.0;
+        for (int w = 0; w < workers; w++)
+            new_error += partial_error[w];
+
+        // Two slots wanting the same thread can make a step worse, keep the last good palette
+        if (new_error >= error) {
+            chosen = previous;
+            break;
+        }
+        error = new_error;
+        previous = chosen;
+
+        std::vector<std::array<double, 4>> totals(k, std::array<double, 4>{0.0, 0.0, 0.0, 0.0});
+        for (int w = 0; w < workers; w++) {
+            for (int s = 0; s < k; s++) {
+                for (int j = 0; j < 4; j++)
+                    totals[s][j] += partial_sums[w][s][j];
             }
+        }
+
+        // Slots covering the most pixels get first pick, slots with no cells keep their thread
+        std::vector<int> order(k);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&totals](int a, int b) { return totals[a][3] > totals[b][3]; });
+        std::vector<bool> taken(_palette->size(), false);
+        for (int s = 0; s < k; s++) {
+            if (totals[s][3] <= 0.0)
+                taken[chosen[s]] = true;
+        }
 
-            for (int i = 0; i < palette.size(); i++) {
-                if (t == palette[i]) {
-                    palette.erase(palette.begin() + i);
-                    break;
+        for (int s : order) {
+            if (totals[s][3] <= 0.0)
+                continue;
+
+            std::array<double, 3> mean = {totals[s][0] / totals[s][3], totals[s][1] / totals[s][3], totals[s][2] / totals[s][3]};
+            int best = chosen[s];
+            double minimum_distance_sq = DBL_MAX;
+            for (int i = 0; i < _palette->size(); i++) {
+                if (taken[i])
+                    continue;
+
+                double distance = thread_distance_sq(mean, (*_palette)[i]);
+                if (distance < minimum_distance_sq) {
+                    minimum_distance_sq = distance;
+                    best = i;
                 }
             }
+            taken[best] = true;
+            chosen[s] = best;
+        }
+
+        changed_slots.clear();
+        for (int s = 0; s < k; s++) {
+            slot_changed[s] = chosen[s] != previous[s];
+            if (slot_changed[s])
+                changed_slots.push_back(s);
         }
+        if (changed_slots.empty())
+            break;
     }
 
-    std::cout << "palette reduced to: " << new_palette->size() << std::endl;
-    set_palette(new_palette);
+    for (int s = 0; s < k; s++)
+        (*new_palette)[s] = (*_palette)[chosen[s]];
 }
 
 void DitheringAlgorithm::reduce_palette(unsigned char *image, int width, int height, std::vector<Thread*> *new_palette, bool median_cut_floor) {
-    auto *image_vector = new std::vector<RGBcolour>;
+    PROFILE_SCOPE("reduce palette");
+    std::vector<ColourBin> histogram = build_histogram(image, width, height);
     std::vector<RGBcolour> median_cut_points;
-    for (int i = 0; i < width * height; i++) {
-        // Ignore 100% transparent pixels
-        if (image[(i*4)+3] == 0)
-            continue;
-        image_vector->push_back({image[i*4], image[(i*4)+1], image[(i*4)+2]});
-    }
 
     // Median cut can only provide palettes that are powers of 2 so find the smallest
     // power of 2 that is larger than _max_threads. The results will be clustered to
@@ -170,52 +565,23 @@ void DitheringAlgorithm::reduce_palette(unsigned char *image, int width, int hei
     // 2^x = max_threads_power_2, solve for x
     int recursion_depth = floor(log((double)max_threads_power_2) / log(2));
 
-    median_cut(image_vector, recursion_depth, &median_cut_points);
+    median_cut(histogram.data(), histogram.data() + histogram.size(), recursion_depth, &median_cut_points);
 
     // palette is already less than max_threads, set palette and return
     if (median_cut_points.size() <= _max_threads) {
         create_closest_palette(median_cut_points, new_palette);
-        delete image_vector;
-        return;
+    } else {
+        // Otherwise cluster the whole histogram into exactly _max_threads colours, weighted by how
+        // many pixels each cell holds
+        create_closest_palette(kmeans(histogram, _max_threads), new_palette);
     }
 
-    std::vector<std::array<double, 3>> kmeans_data;
-    for (auto mean : median_cut_points) {
-        kmeans_data.push_back({(double)mean.R, (double)mean.G, (double)mean.B});
-    }
-
-    // Reduce palette further with k-means
-    dkm::clustering_parameters<double> params = dkm::clustering_parameters<double>(_max_threads);
-    params.set_min_delta(0.0005);
-    const auto [means, mapping] = dkm::kmeans_lloyd(kmeans_data, params);
-
-    std::vector<RGBcolour> points;
-    for (auto mean : means) {
-        points.push_back(RGBcolour{(int)mean[0], (int)mean[1], (int)mean[2]});
-    }
-
-    create_closest_palette(points, new_palette);
-    delete image_vector;
-    return;
-}
-
-struct Lab {float L; float a; float b;};
-
-// from: https://bottosson.github.io/posts/oklab/
-Lab thread_to_oklab(Thread *t) {
-    float l = 0.4122214708f * t->R + 0.5363325363f * t->G + 0.0514459929f * t->B;
-	float m = 0.2119034982f * t->R + 0.6806995451f * t->G + 0.1073969566f * t->B;
-	float s = 0.0883024619f * t->R + 0.2817188376f * t->G + 0.6299787005f * t->B;
-
-    float l_ = cbrtf(l);
-    float m_ = cbrtf(m);
-    float s_ = cbrtf(s);
+    // The clusters were found without knowing which colours exist as threads, so improve the
+    // choice against the thread colours themselves
+    if (_refine_palette)
+        optimise_palette(histogram, new_palette);
 
-    return {
-        0.2104542553f*l_ + 0.7936177850f*m_ - 0.0040720468f*s_,
-        1.9779984951f*l_ - 2.4285922050f*m_ + 0.4505937099f*s_,
-        0.0259040371f*l_ + 0.7827717662f*m_ - 0.8086757660f*s_,
-    };
+    set_palette(new_palette);
 }
 
 double oklab_total_distance(Lab lab1, Lab lab2) {
@@ -235,57 +601,130 @@ double oklab_hue_distance(Lab lab1, Lab lab2) {
     return sqrt(pow(delta_a, 2) + pow(delta_b, 2) - pow(delta_C, 2));
 }
 
-void DitheringAlgorithm::expand_palette(std::vector<Thread*> *new_palette) {
-    std::vector<BlendedThread*> added_threads;
+// Whether two threads are close enough in colour that blending them will look right
+static bool blendable(Lab lab1, Lab lab2) {
+    // Only consider blending threads which are close in colour
+    // Testing difference in Oklab colourspace, since perceptual uniformity
+    // is more important here
+    double distance = oklab_total_distance(lab1, lab2);
+    double ave_L = (lab1.L + lab2.L) / 2.0;
+    // adding to distance using a `y = 0.7 sqrt(x - 5.4)` curve, as colours that are pastel
+    // (ie: have high L values, above 5.5 but usually closer to 6.0) will otherwise slip past
+    // the threshold.
+    // see: https://graphicdesign.stackexchange.com/questions/164653/color-difference-functions-are-not-good-what-am-i-missing
+    distance = ave_L >= 5.4 ? distance + (0.7 * sqrt(ave_L - 5.4)) : distance;
+    if (distance > BLEND_MAX_DISTANCE)
+        return false;
+
+    // Colours that have similar lightnesses can still clash if their hue is very different
+    double hue_distance = oklab_hue_distance(lab1, lab2);
+    if (hue_distance > BLEND_MAX_HUE_DISTANCE)
+        return false;
+
+    return true;
+}
 
-    for (Thread *t1 : *_palette) {
-        new_palette->push_back(t1);
+struct ThreadPairHash {
+    size_t operator()(const std::pair<Thread*, Thread*>& pair) const {
+        size_t hash = std::hash<Thread*>()(pair.first);
+        return hash ^ (std::hash<Thread*>()(pair.second) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    }
+};
 
-        for (Thread *t2 : *_palette) {
-            // Don't blend threads with themselves
-            if (t1 == t2)
-                continue;
+// Indexes into a palette of the threads to blend, the first index is always the lower one and
+// the pairs are sorted
+using BlendPairs = std::vector<std::pair<int, int>>;
+
+static BlendPairs find_blend_pairs(const std::vector<Thread*>& palette) {
+    int n = palette.size();
+    std::vector<Lab> labs(n);
+    for (int i = 0; i < n; i++)
+        labs[i] = palette[i]->lab;
+
+    // The lightness difference is part of the total distance and the pastel adjustment only adds
+    // to it, so with the threads sorted by lightness each thread only has to be compared to the
+    // ones after it until the lightness gap passes the threshold
+    std::vector<int> by_lightness(n);
+    std::iota(by_lightness.begin(), by_lightness.end(), 0);
+    std::stable_sort(by_lightness.begin(), by_lightness.end(), [&labs](int a, int b) { return labs[a].L < labs[b].L; });
+
+    BlendPairs pairs;
+    // The same thread can appear in the palette more than once, only blend each pair once
+    std::unordered_set<std::pair<Thread*, Thread*>, ThreadPairHash> added;
+    for (int i = 0; i < n; i++) {
+        int first = by_lightness[i];
+        for (int j = i + 1; j < n; j++) {
+            int second = by_lightness[j];
+            if (labs[second].L - labs[first].L > BLEND_MAX_DISTANCE)
+                break;
 
-            // Only consider blending threads which are close in colour
-            // Testing difference in Oklab colourspace, since perceptual uniformity
-            // is more important here
-            Lab lab1 = thread_to_oklab(t1);
-            Lab lab2 = thread_to_oklab(t2);
-            double distance = oklab_total_distance(lab1, lab2);
-            double ave_L = (lab1.L + lab2.L) / 2.0;
-            // adding to distance using a `y = 0.7 sqrt(x - 5.4)` curve, as colours that are pastel
-            // (ie: have high L values, above 5.5 but usually closer to 6.0) will otherwise slip past
-            // the threshold.
-            // see: https://graphicdesign.stackexchange.com/questions/164653/color-difference-functions-are-not-good-what-am-i-missing
-            distance = ave_L >= 5.4 ? distance + (0.7 * sqrt(ave_L - 5.4)) : distance;
-            if (distance > 1.0)
+            // Don't blend threads with themselves
+            if (palette[first] == palette[second] || !blendable(labs[first], labs[second]))
                 continue;
 
-            // Colours that have similar lightnesses can still clash if their hue is very different
-            double hue_distance = oklab_hue_distance(lab1, lab2);
-            if (hue_distance > 0.3)
-                continue;
+            pairs.push_back(std::minmax(first, second));
+        }
+    }
 
-            // Ignore any duplicate combinations
-            BlendedThread *bt1 = new BlendedThread(create_blended_thread((SingleThread*)t1, (SingleThread*)t2));
-            bool duplicate = false;
-            for (BlendedThread *bt2 : added_threads) {
-                if (is_duplicate(bt1, bt2)) {
-                    delete bt1;
-                    duplicate = true;
-                    break;
-                }
-            }
-            if (duplicate)
-                continue;
+    // Keep the order the palette would be searched in, so the blend an earlier pair produced wins
+    std::sort(pairs.begin(), pairs.end());
+    std::erase_if(pairs, [&](const std::pair<int, int>& pair) {
+        Thread *t1 = palette[pair.first];
+        Thread *t2 = palette[pair.second];
+        return !added.insert(t1 < t2 ? std::make_pair(t1, t2) : std::make_pair(t2, t1)).second;
+    });
+    return pairs;
+}
 
-            // std::cout << fmt::format("{} -> {}, {}, {} | {}, {}, {} -> {}, {} -> L:{} a:{} b:{} | L:{} a:{} b:{}", bt1->full_name(ThreadPosition::BOTH), t1->R, t1->G, t1->B, t2->R, t2->G, t2->B, distance, hue_distance, lab1.L, lab1.a, lab1.b, lab2.L, lab2.a, lab2.b) << std::endl;
+// Each thread in palette followed by its blends with the threads after it. The blends are shared,
+// so the same palette always expands to the same threads.
+static std::vector<Thread*> blend_palette(const std::vector<Thread*>& palette) {
+    BlendPairs pairs = find_blend_pairs(palette);
+
+    std::vector<Thread*> blended;
+    blended.reserve(palette.size() + pairs.size());
+    auto pair = pairs.begin();
+    for (int i = 0; i < palette.size(); i++) {
+        Thread *t1 = palette[i];
+        blended.push_back(t1);
+
+        for (; pair != pairs.end() && pair->first == i; pair++) {
+            Thread *t2 = palette[pair->second];
+            blended.push_back(get_blended_thread((SingleThread*)t1, (SingleThread*)t2));
+        }
+    }
+    return blended;
+}
 
-            added_threads.push_back(bt1);
-            new_palette->push_back(bt1);
+// Recently expanded palettes and what they expanded to, newest first. The palettes only ever hold
+// catalogue threads and the blends of them, which live for as long as the application does.
+static std::mutex blend_table_mutex;
+static std::list<std::pair<std::vector<Thread*>, std::shared_ptr<const std::vector<Thread*>>>> blend_table;
+
+static std::shared_ptr<const std::vector<Thread*>> blended_palette(const std::vector<Thread*>& palette) {
+    {
+        std::lock_guard<std::mutex> lock(blend_table_mutex);
+        for (auto entry = blend_table.begin(); entry != blend_table.end(); entry++) {
+            if (entry->first == palette) {
+                blend_table.splice(blend_table.begin(), blend_table, entry);
+                return entry->second;
+            }
         }
     }
 
+    // Worked out without the lock so a large palette doesn't hold up the others
+    auto blended = std::make_shared<const std::vector<Thread*>>(blend_palette(palette));
+
+    std::lock_guard<std::mutex> lock(blend_table_mutex);
+    blend_table.emplace_front(palette, blended);
+    if (blend_table.size() > BLEND_TABLE_SIZE)
+        blend_table.pop_back();
+    return blended;
+}
+
+void DitheringAlgorithm::expand_palette(std::vector<Thread*> *new_palette) {
+    PROFILE_SCOPE("blend threads");
+    *new_palette = *blended_palette(*_palette);
     set_palette(new_palette);
 }
 
@@ -294,20 +733,6 @@ void DitheringAlgorithm::set_palette(std::vector<Thread*> *new_palette) {
     _palette = new_palette;
 }
 
-void FloydSteinburg::apply_quant_error(int err_R, int err_G, int err_B, int *quant_error_ptr, int x, int y, int width, int height, float coefficient) {
-    // check bounds
-    if (x >= width || y >= height)
-        return;
-
-    // apply offset
-    quant_error_ptr += 3 * INDEX(x, y, width);
-
-    // add error
-    *quant_error_ptr += err_R * coefficient;
-    *(quant_error_ptr + 1) += err_G * coefficient;
-    *(quant_error_ptr + 2) += err_B * coefficient;
-}
-
 void DitheringAlgorithm::draw_stitch(int x, int y, int height, Thread *new_pixel, Project *project) {
     bool drawn = false;
     for (int j = 0; j < project->palette.size(); j++) {
@@ -323,85 +748,273 @@ void DitheringAlgorithm::draw_stitch(int x, int y, int height, Thread *new_pixel
     }
 }
 
-void FloydSteinburg::dither(unsigned char *image, int width, int height, Project *project) {
-    std::vector<Thread*> new_palette;
-    if (_palette->size() > _max_threads) {
-        reduce_palette(image, width, height, &new_palette);
+void DitheringAlgorithm::commit_stitches(int width, int height, Project *project) {
+    PROFILE_SCOPE("commit stitches");
+    std::vector<int> project_indices(_palette->size(), -1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = INDEX(x, y, width);
+            if (_mask != nullptr && _mask[i] == 0)
+                continue;
+
+            nanogui::Vector2i stitch(x, height - y - 1);
+            int palette_index = _stitches[i];
+            if (palette_index == -1) {
+                if (project->thread_data[stitch[0]][stitch[1]] != -1)
+                    project->erase_stitch(stitch);
+                continue;
+            }
+
+            if (project_indices[palette_index] == -1) {
+                Thread *thread = (*_palette)[palette_index];
+                for (int j = 0; j < project->palette.size(); j++) {
+                    if (project->palette[j] == thread) {
+                        project_indices[palette_index] = j;
+                        break;
+                    }
+                }
+                if (project_indices[palette_index] == -1) {
+                    project->palette.push_back(thread);
+                    project_indices[palette_index] = project->palette.size() - 1;
+                }
+            }
+
+            int project_index = project_indices[palette_index];
+            project->draw_stitch(stitch, project->palette[project_index], project_index);
+        }
+    }
+}
+
+void DitheringAlgorithm::run_workers(int workers, const std::function<void(int)>& worker) {
+    // Each worker is timed on its own thread, so traces show how evenly the work was split
+    auto timed_worker = [&worker](int n) {
+        PROFILE_SCOPE("dither worker");
+        worker(n);
+    };
+    std::vector<std::thread> threads;
+    for (int n = 1; n < workers; n++)
+        threads.emplace_back(timed_worker, n);
+    timed_worker(0);
+    for (std::thread& t : threads)
+        t.join();
+}
+
+void DitheringAlgorithm::report_progress(DitheringStage stage, int rows_done, int rows_total) {
+    if (_control != nullptr && _control->progress)
+        _control->progress(stage, rows_done, rows_total);
+}
+
+void DitheringAlgorithm::row_finished(int height) {
+    int rows_done = _rows_done.fetch_add(1, std::memory_order_relaxed) + 1;
+    report_progress(DitheringStage::DITHERING, rows_done, height);
+}
+
+void DitheringAlgorithm::begin_dither(unsigned char *image, int width, int height) {
+    if (_mask != nullptr) {
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            if (_mask[i] == 0)
+                image[(i * 4) + 3] = 0;
+        }
     }
+    _stitches.assign((size_t)width * height, -1);
 
-    std::vector<Thread*> new_new_palette;
-    if (_blend_threads) {
-        expand_palette(&new_new_palette);
+    if (!_palette_prepared && _palette->size() > _max_threads) {
+        report_progress(DitheringStage::REDUCING_PALETTE, 0, height);
+        reduce_palette(image, width, height, &_reduced_palette);
     }
 
-    int *quant_error = new int[width * height * 3];
-    for (int i = 0; i < width * height * 3; i++) {
-        quant_error[i] = 0;
+    if (!_palette_prepared && _blend_threads && !cancelled()) {
+        report_progress(DitheringStage::BLENDING_THREADS, 0, height);
+        expand_palette(&_blended_palette);
     }
 
-    int i;
-    int q_i;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            i = 4 * INDEX(x, y, width);
-            q_i = 3 * INDEX(x, y, width);
-            // It would be ideal to smartly handle opacity. Do not have time
-            // to do this. Any areas that are 100% transparent are blank,
-            // any other opacity level is treated as 100% opaque.
-            if ((int)image[i+3] == 0)
-                continue;
+    _palette_colours.clear();
+    _palette_colours.reserve(_palette->size());
+    for (Thread *thread : *_palette)
+        _palette_colours.push_back(RGBcolour{thread->R, thread->G, thread->B});
 
-            // Clamp to 0..255
-            RGBcolour old_pixel = RGBcolour{
-                std::clamp(image[i] + quant_error[q_i], 0, 255),
-                std::clamp(image[i+1] + quant_error[q_i+1], 0, 255),
-                std::clamp(image[i+2] + quant_error[q_i+2], 0, 255)
-            };
-            Thread *new_pixel = find_nearest_neighbour(old_pixel);
-
-            // Find the quantisation error and spread it across neighbouring pixels.
-            int err_R = old_pixel.R - new_pixel->R;
-            int err_G = old_pixel.G - new_pixel->G;
-            int err_B = old_pixel.B - new_pixel->B;
-            apply_quant_error(err_R, err_G, err_B, quant_error,
-                              x + 1, y    , width, height, FS_ERR_RIGHT);
-            apply_quant_error(err_R, err_G, err_B, quant_error,
-                              x - 1, y + 1, width, height, FS_ERR_DOWN_LEFT);
-            apply_quant_error(err_R, err_G, err_B, quant_error,
-                              x    , y + 1, width, height, FS_ERR_DOWN);
-            apply_quant_error(err_R, err_G, err_B, quant_error,
-                              x + 1, y + 1, width, height, FS_ERR_DOWN_RIGHT);
-
-            draw_stitch(x, y, height, new_pixel, project);
+    _rows_done = 0;
+    report_progress(DitheringStage::DITHERING, 0, height);
+}
+
+void DitheringAlgorithm::threshold_dither(unsigned char *image, int width, int height, Project *project,
+                                          const int *thresholds, int tile_size) {
+    // Every pixel is independent, so each worker takes a contiguous block of rows
+    int workers = std::max(1, std::min(_workers, height));
+
+    auto worker = [&](int n) {
+        std::map<RGBcolour, int> cache;
+        int last_row = (n + 1) * height / workers;
+        for (int y = n * height / workers; y < last_row && !cancelled(); y++) {
+            const int *tile_row = thresholds + ((y & (tile_size - 1)) * tile_size);
+            for (int x = 0; x < width; x++) {
+                int i = 4 * INDEX(x, y, width);
+                // Transparent pixels are left blank
+                if ((int)image[i+3] == 0)
+                    continue;
+
+                int factor = tile_row[x & (tile_size - 1)];
+                _stitches[INDEX(x, y, width)] = find_nearest_index(RGBcolour{
+                    std::clamp(image[i] + factor, 0, 255), std::clamp(image[i+1] + factor, 0, 255), std::clamp(image[i+2] + factor, 0, 255)
+                }, &cache);
+            }
+            row_finished(height);
         }
-    }
+    };
+
+    run_workers(workers, worker);
+
+    if (cancelled())
+        return;
+    commit_stitches(width, height, project);
+}
+
+BlueNoise::BlueNoise(std::vector<Thread*> *palette, int max_threads, bool blend_threads) : DitheringAlgorithm(palette, max_threads, blend_threads) {
+    const std::vector<uint16_t>& tile = blue_noise_tile();
+    _matrix.reserve(tile.size());
+    for (uint16_t rank : tile)
+        _matrix.push_back(rank_to_threshold(rank, tile.size()));
+}
+
+void BlueNoise::dither(unsigned char *image, int width, int height, Project *project) {
+    begin_dither(image, width, height);
+    if (cancelled())
+        return;
 
-    delete[] quant_error;
+    threshold_dither(image, width, height, project, _matrix.data(), BLUE_NOISE_SIZE);
 }
 
 void NoDither::dither(unsigned char *image, int width, int height, Project *project) {
-    std::vector<Thread*> new_palette;
-    if (_palette->size() > _max_threads) {
-        reduce_palette(image, width, height, &new_palette);
-    }
+    begin_dither(image, width, height);
+    if (cancelled())
+        return;
+
+    // A 1x1 tile of zero, so every pixel is just matched to its nearest thread
+    const int no_threshold = 0;
+    threshold_dither(image, width, height, project, &no_threshold, 1);
+}
+
+template <typename Algorithm>
+static void run_algorithm(const DitheringSettings& settings, Algorithm& algorithm, unsigned char *image, int width, int height,
+                          Project *project, DitheringControl *control, std::vector<Thread*> *prepared_palette,
+                          const unsigned char *mask) {
+    algorithm.set_control(control);
+    algorithm.set_refine_palette(settings.refine_palette);
+    algorithm.set_mask(mask);
+    bool reuse_palette = prepared_palette != nullptr && !prepared_palette->empty();
+    if (reuse_palette)
+        algorithm.set_prepared_palette(prepared_palette);
+
+    algorithm.dither(image, width, height, project);
+
+    bool cancelled = control != nullptr && control->cancelled;
+    if (prepared_palette != nullptr && !reuse_palette && !cancelled)
+        *prepared_palette = algorithm.working_palette();
+}
+
+template <uint ORDER>
+static void run_bayer(const DitheringSettings& settings, std::vector<Thread*> *palette, unsigned char *image, int width, int height,
+                      Project *project, DitheringControl *control, std::vector<Thread*> *prepared_palette,
+                      const unsigned char *mask) {
+    Bayer<ORDER> bayer(palette, settings.max_threads, settings.blend_threads);
+    run_algorithm(settings, bayer, image, width, height, project, control, prepared_palette, mask);
+}
 
-    std::vector<Thread*> new_new_palette;
-    if (_blend_threads) {
-        expand_palette(&new_new_palette);
+void prepare_alpha(unsigned char *image, int width, int height, int alpha_mode, int alpha_cutoff, nanogui::Color background) {
+    int background_colour[3] = {
+        color_float_to_int(background.r()),
+        color_float_to_int(background.g()),
+        color_float_to_int(background.b())
+    };
+    bool composite = alpha_mode == AlphaModes::COMPOSITE;
+    // Blending fades partly transparent pixels into the background, so only fully transparent
+    // ones are left blank
+    if (composite)
+        alpha_cutoff = 1;
+    size_t no_pixels = (size_t)width * height;
+
+    // Written without branches so that the compiler can vectorise it
+    for (size_t i = 0; i < no_pixels; i++) {
+        unsigned char *pixel = image + (i * 4);
+        int opaque = pixel[3] >= alpha_cutoff;
+        // Thresholding keeps the colour as it is, the same as blending it at full opacity
+        int weight = composite ? pixel[3] : 255;
+        for (int c = 0; c < 3; c++) {
+            int blended = (pixel[c] * weight) + (background_colour[c] * (255 - weight)) + 128;
+            // Divides by 255, rounding to nearest
+            pixel[c] = ((blended + (blended >> 8)) >> 8) * opaque;
+        }
+        pixel[3] = 255 * opaque;
     }
+}
 
-    int i;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            i = 4 * INDEX(x, y, width);
-            // It would be ideal to smartly handle opacity. Do not have time
-            // to do this. Any areas that are 100% transparent are blank,
-            // any other opacity level is treated as 100% opaque.
-            if ((int)image[i+3] == 0)
-                continue;
+std::vector<unsigned char> mask_from_regions(int width, int height, const std::vector<DitheringRegion>& regions) {
+    std::vector<unsigned char> mask((size_t)width * height, 0);
+    for (const DitheringRegion& region : regions) {
+        int left = std::max(region.x, 0);
+        int right = std::min(region.x + region.width, width);
+        for (int y = std::max(region.y, 0); y < std::min(region.y + region.height, height); y++) {
+            if (left < right)
+                std::fill(mask.begin() + INDEX(left, y, width), mask.begin() + INDEX(right, y, width), 1);
+        }
+    }
+    return mask;
+}
 
-            Thread *new_pixel = find_nearest_neighbour(RGBcolour{image[i], image[i+1], image[i+2]});
-            draw_stitch(x, y, height, new_pixel, project);
+void dither_image(const DitheringSettings& settings, std::vector<Thread*> *palette, unsigned char *image, int width, int height,
+                  Project *project, DitheringControl *control, std::vector<Thread*> *prepared_palette,
+                  const unsigned char *mask) {
+    if (width != project->width || height != project->height)
+        throw std::invalid_argument("The image must be the same size as the project");
+
+    prepare_alpha(image, width, height, settings.alpha_mode, settings.alpha_cutoff, project->bg_color);
+
+    if (settings.algorithm == DitheringAlgorithms::FLOYD_STEINBURG) {
+        FloydSteinburg floyd_steinburg(palette, settings.max_threads, settings.blend_threads, settings.serpentine);
+        run_algorithm(settings, floyd_steinburg, image, width, height, project, control, prepared_palette, mask);
+    } else if (settings.algorithm == DitheringAlgorithms::ATKINSON) {
+        Atkinson atkinson(palette, settings.max_threads, settings.blend_threads, settings.serpentine);
+        run_algorithm(settings, atkinson, image, width, height, project, control, prepared_palette, mask);
+    } else if (settings.algorithm == DitheringAlgorithms::JARVIS_JUDICE_NINKE) {
+        JarvisJudiceNinke jarvis_judice_ninke(palette, settings.max_threads, settings.blend_threads, settings.serpentine);
+        run_algorithm(settings, jarvis_judice_ninke, image, width, height, project, control, prepared_palette, mask);
+    } else if (settings.algorithm == DitheringAlgorithms::STUCKI) {
+        Stucki stucki(palette, settings.max_threads, settings.blend_threads, settings.serpentine);
+        run_algorithm(settings, stucki, image, width, height, project, control, prepared_palette, mask);
+    } else if (settings.algorithm == DitheringAlgorithms::SIERRA) {
+        Sierra sierra(palette, settings.max_threads, settings.blend_threads, settings.serpentine);
+        run_algorithm(settings, sierra, image, width, height, project, control, prepared_palette, mask);
+    } else if (settings.algorithm == DitheringAlgorithms::BAYER) {
+        switch (settings.bayer_order) {
+        case BayerOrders::TWO:
+            run_bayer<BayerOrders::TWO>(settings, palette, image, width, height, project, control, prepared_palette, mask);
+            break;
+        case BayerOrders::FOUR:
+            run_bayer<BayerOrders::FOUR>(settings, palette, image, width, height, project, control, prepared_palette, mask);
+            break;
+        case BayerOrders::EIGHT:
+            run_bayer<BayerOrders::EIGHT>(settings, palette, image, width, height, project, control, prepared_palette, mask);
+            break;
+        case BayerOrders::SIXTEEN:
+            run_bayer<BayerOrders::SIXTEEN>(settings, palette, image, width, height, project, control, prepared_palette, mask);
+            break;
+        case BayerOrders::THIRTY_TWO:
+            run_bayer<BayerOrders::THIRTY_TWO>(settings, palette, image, width, height, project, control, prepared_palette, mask);
+            break;
+        case BayerOrders::SIXTY_FOUR:
+            run_bayer<BayerOrders::SIXTY_FOUR>(settings, palette, image, width, height, project, control, prepared_palette, mask);
+            break;
+        default:
+            throw std::invalid_argument("The matrix size selected is not recognised, please try another");
         }
+    } else if (settings.algorithm == DitheringAlgorithms::BLUE_NOISE) {
+        BlueNoise blue_noise(palette, settings.max_threads, settings.blend_threads);
+        run_algorithm(settings, blue_noise, image, width, height, project, control, prepared_palette, mask);
+    } else if (settings.algorithm == DitheringAlgorithms::QUANTISE) {
+        NoDither no_dither(palette, settings.max_threads, settings.blend_threads);
+        run_algorithm(settings, no_dither, image, width, height, project, control, prepared_palette, mask);
+    } else {
+        throw std::invalid_argument("The algorithm selected is not recognised, please try another");
     }
 }
\ No newline at end of file
@@ -1,20 +1,36 @@
 #pragma once
 #include <vector>
+#include <array>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <functional>
 #include "threads.hpp"
 #include "project.hpp"
 
 #define INDEX(x, y, width) (x + (width * y))
-#define THRESHOLD_COLOUR 0.64f
 #define THRESHOLD_GREYSCALE 1.f
+// Threshold matrices range from -THRESHOLD_SPREAD/2 to THRESHOLD_SPREAD/2, which is roughly
+// the gap between neighbouring colours in a thread catalogue
+#define THRESHOLD_SPREAD 32.f
 
 enum BayerOrders {
     TWO = 2U,
     FOUR = 4U,
     EIGHT = 8U,
-    SIXTEEN = 16U
+    SIXTEEN = 16U,
+    THIRTY_TWO = 32U,
+    SIXTY_FOUR = 64U
 };
 
+// Turns a rank from a threshold matrix with the given number of cells into an offset centred on
+// zero, so that dithering doesn't change the average brightness of the image
+constexpr int rank_to_threshold(int rank, int cells) {
+    float threshold = ((rank + 0.5f) / cells - 0.5f) * THRESHOLD_SPREAD;
+    return threshold < 0.f ? (int)(threshold - 0.5f) : (int)(threshold + 0.5f);
+}
+
 struct RGBcolour {
     int R = -1;
     int G = -1;
@@ -33,13 +49,64 @@ struct RGBcolour {
     }
 };
 
+enum DitheringAlgorithms {
+    FLOYD_STEINBURG,
+    ATKINSON,
+    JARVIS_JUDICE_NINKE,
+    STUCKI,
+    SIERRA,
+    BAYER,
+    BLUE_NOISE,
+    QUANTISE
+};
+
+enum DitheringStage {
+    REDUCING_PALETTE,
+    BLENDING_THREADS,
+    DITHERING
+};
+
+// Lets a dither running on another thread report how far it has got and be stopped early.
+// progress is optional and is called from the worker threads, so it has to be thread safe.
+struct DitheringControl {
+    std::function<void(DitheringStage stage, int rows_done, int rows_total)> progress;
+    std::atomic<bool> cancelled = false;
+};
+
+// Bits kept from each channel when counting the colours in an image
+#define HISTOGRAM_BITS 5
+#define HISTOGRAM_LEVELS (1 << HISTOGRAM_BITS)
+
+// All of the pixels in an image that fall into one histogram cell
+struct ColourBin {
+    // Position of the cell, each channel is from 0 to HISTOGRAM_LEVELS-1
+    int level[3];
+    int64_t count;
+    // Sum of each channel over the pixels, so the exact mean colour can be found
+    int64_t sum[3];
+};
+
 class DitheringAlgorithm {
 public:
-    DitheringAlgorithm(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false)
-    : _palette(palette), _blend_threads(blend_threads)
-    {
-        _max_threads = max_threads <= 0 ? 1 : max_threads;
-    };
+    DitheringAlgorithm(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false);
+
+    // When the control is cancelled dither returns as soon as it can, leaving the project partly
+    // drawn, so it should be thrown away
+    void set_control(DitheringControl *control) { _control = control; };
+    // Dithers with palette as it is, skipping palette reduction and thread blending. Use this with
+    // the working_palette of an earlier dither of the same image and palette settings to save time.
+    void set_prepared_palette(std::vector<Thread*> *palette) { set_palette(palette); _palette_prepared = true; };
+    // Only dithers the pixels where mask is non zero, leaving the rest of the project's stitches as
+    // they are. mask has a byte for each pixel, in the same order as the image, and must outlive
+    // dither. Pixels outside the mask are made transparent in the image, so they are left out of
+    // palette reduction and error diffusion stops at the edge of the mask.
+    void set_mask(const unsigned char *mask) { _mask = mask; };
+    // Palette reduction picks the threads nearest to the clusters it finds, then (by default)
+    // swaps them for other threads while that lowers the error. Turning refining off skips the
+    // swapping, which is faster but matches the image less closely.
+    void set_refine_palette(bool refine) { _refine_palette = refine; };
+    // The palette colours were matched against in the last dither, after any reduction and blending
+    const std::vector<Thread*>& working_palette() const { return *_palette; };
 
     // Finds the nearest colour from the available palette using a euclidian distance calculation
     // which is optimised using an internal cache
@@ -49,152 +116,434 @@ protected:
     int _max_threads;
     std::vector<Thread*> *_palette = nullptr;
     bool _blend_threads;
+    // Number of worker threads the parallel algorithms spread their rows across
+    int _workers;
+    DitheringControl *_control = nullptr;
+    std::atomic<int> _rows_done = 0;
+    bool _palette_prepared = false;
+    bool _refine_palette = true;
+    // begin_dither leaves _palette pointing at one of these
+    std::vector<Thread*> _reduced_palette;
+    std::vector<Thread*> _blended_palette;
+    // Colours of the threads in _palette, in the same order, set by begin_dither so that matching
+    // pixels reads one array instead of following a pointer to each thread
+    std::vector<RGBcolour> _palette_colours;
+    const unsigned char *_mask = nullptr;
+    // Index into the current palette of the thread chosen for each pixel (in the same order as the
+    // image) or -1 if the pixel is blank, written by the workers and drawn by commit_stitches
+    std::vector<int> _stitches;
 
+    // Calls worker(0..workers-1), each on its own thread except worker 0 which runs on the calling
+    // thread, and waits for them all to finish
+    void run_workers(int workers, const std::function<void(int)>& worker);
+    bool cancelled() const { return _control != nullptr && _control->cancelled.load(std::memory_order_relaxed); };
+    void report_progress(DitheringStage stage, int rows_done, int rows_total);
+    // Called by the workers after each row
+    void row_finished(int height);
+    // Applies the mask to image and reduces and/or blends the palette as configured, unless a
+    // prepared palette was given. Every dither starts with this.
+    void begin_dither(unsigned char *image, int width, int height);
     void set_palette(std::vector<Thread*> *new_palette);
     void reduce_palette(unsigned char *image, int width, int height, std::vector<Thread*> *new_palette, bool median_cut_floor = false);
     void draw_stitch(int x, int y, int height, Thread *new_pixel, Project *project);
     void expand_palette(std::vector<Thread*> *new_palette);
+    // Same as find_nearest_neighbour, but returns an index into the current palette and uses a
+    // caller owned cache, so that it can be called from several worker threads at once
+    int find_nearest_index(RGBcolour colour, std::map<RGBcolour, int> *cache);
+    // Converts _stitches into project palette indices (reusing threads already in the project
+    // palette, otherwise adding them in the order they are first used) and draws them, erasing the
+    // stitches of blank pixels. Pixels outside the mask are left alone.
+    void commit_stitches(int width, int height, Project *project);
+    // Quantises each pixel independently after adding thresholds[y % tile_size][x % tile_size] to
+    // it, spread across all the workers. tile_size must be a power of two.
+    void threshold_dither(unsigned char *image, int width, int height, Project *project,
+                          const int *thresholds, int tile_size);
 
 private:
     std::map<RGBcolour, Thread*> _nearest_cache;
 
-    void median_cut(std::vector<RGBcolour> *image, int depth, std::vector<RGBcolour> *points);
-    void create_closest_palette(std::vector<RGBcolour> CIELuv_averages, std::vector<Thread*> *new_palette);
+    // Counts the colours of all the non transparent pixels, returning only the cells that are used
+    std::vector<ColourBin> build_histogram(unsigned char *image, int width, int height);
+    // Splits the bins between begin and end into (up to) 2^depth boxes and adds the mean colour of
+    // each box to points. Each split partitions the bins in place at the median pixel of the widest
+    // channel, found by counting pixels per level rather than sorting.
+    void median_cut(ColourBin *begin, ColourBin *end, int depth, std::vector<RGBcolour> *points);
+    // Weighted k-means over the histogram cells, returns the k (or fewer if there aren't enough
+    // distinct colours) cluster means
+    std::vector<RGBcolour> kmeans(const std::vector<ColourBin>& histogram, int k);
+    // Adds the nearest thread to each average to new_palette, skipping threads already taken
+    void create_closest_palette(const std::vector<RGBcolour>& averages, std::vector<Thread*> *new_palette);
+    // Swaps the threads in new_palette for other threads in the palette while that lowers the
+    // pixel weighted error of the histogram against the actual thread colours
+    void optimise_palette(const std::vector<ColourBin>& histogram, std::vector<Thread*> *new_palette);
+};
+
+// Error diffusion kernels. WEIGHTS[0] is the current row and WEIGHTS[1..] the rows below it,
+// column LEFT is the pixel being dithered. Each weight is divided by DIVISOR.
+struct FloydSteinburgKernel {
+    static constexpr int LEFT = 1;
+    static constexpr int RIGHT = 1;
+    static constexpr int ROWS = 2;
+    static constexpr int DIVISOR = 16;
+    static constexpr int WEIGHTS[ROWS][LEFT + 1 + RIGHT] = {
+        {0, 0, 7},
+        {3, 5, 1}
+    };
+};
+
+// Only diffuses 6/8 of the error, which keeps more contrast
+struct AtkinsonKernel {
+    static constexpr int LEFT = 1;
+    static constexpr int RIGHT = 2;
+    static constexpr int ROWS = 3;
+    static constexpr int DIVISOR = 8;
+    static constexpr int WEIGHTS[ROWS][LEFT + 1 + RIGHT] = {
+        {0, 0, 1, 1},
+        {1, 1, 1, 0},
+        {0, 1, 0, 0}
+    };
+};
+
+struct JarvisJudiceNinkeKernel {
+    static constexpr int LEFT = 2;
+    static constexpr int RIGHT = 2;
+    static constexpr int ROWS = 3;
+    static constexpr int DIVISOR = 48;
+    static constexpr int WEIGHTS[ROWS][LEFT + 1 + RIGHT] = {
+        {0, 0, 0, 7, 5},
+        {3, 5, 7, 5, 3},
+        {1, 3, 5, 3, 1}
+    };
+};
+
+struct StuckiKernel {
+    static constexpr int LEFT = 2;
+    static constexpr int RIGHT = 2;
+    static constexpr int ROWS = 3;
+    static constexpr int DIVISOR = 42;
+    static constexpr int WEIGHTS[ROWS][LEFT + 1 + RIGHT] = {
+        {0, 0, 0, 8, 4},
+        {2, 4, 8, 4, 2},
+        {1, 2, 4, 2, 1}
+    };
+};
+
+struct SierraKernel {
+    static constexpr int LEFT = 2;
+    static constexpr int RIGHT = 2;
+    static constexpr int ROWS = 3;
+    static constexpr int DIVISOR = 32;
+    static constexpr int WEIGHTS[ROWS][LEFT + 1 + RIGHT] = {
+        {0, 0, 0, 5, 3},
+        {2, 4, 5, 4, 2},
+        {0, 2, 3, 2, 0}
+    };
 };
 
-class FloydSteinburg : DitheringAlgorithm {
+template <typename Kernel>
+class ErrorDiffusion : DitheringAlgorithm {
 public:
-    FloydSteinburg(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false) : DitheringAlgorithm(palette, max_threads, blend_threads) {};
+    ErrorDiffusion(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false, bool serpentine = false)
+    : DitheringAlgorithm(palette, max_threads, blend_threads), _serpentine(serpentine) {};
+
+    using DitheringAlgorithm::set_control;
+    using DitheringAlgorithm::set_prepared_palette;
+    using DitheringAlgorithm::set_mask;
+    using DitheringAlgorithm::set_refine_palette;
+    using DitheringAlgorithm::working_palette;
 
     void dither(unsigned char *image, int width, int height, Project *project);
 
 private:
-    void apply_quant_error(int err_R, int err_G, int err_B, int *quant_error_ptr, int x, int y, int width, int height, float coefficient);
+    static constexpr int COLUMNS = Kernel::LEFT + 1 + Kernel::RIGHT;
+    // Row y can process pixel x once row y-1 has processed pixel x+LEFT+RIGHT, at that point every
+    // error contribution to the pixels row y will read or add to has been made, in the same order
+    // as a sequential pass
+    static constexpr int ROW_LAG = Kernel::LEFT + Kernel::RIGHT + 1;
+    // Pixels closer than this to either side of the image need bounds checks
+    static constexpr int MARGIN = std::max(Kernel::LEFT, Kernel::RIGHT);
+
+    bool _serpentine;
+
+    void dither_row(unsigned char *image, int width, int height, int y, int *error_rows,
+                    std::vector<std::atomic<int>> *progress, std::map<RGBcolour, int> *cache, Project *project);
+    template <bool CHECK_BOUNDS>
+    void dither_pixel(unsigned char *image, int x, int y, int width, int height, int direction,
+                      int **rows, int rows_below, std::map<RGBcolour, int> *cache, Project *project);
+    template <bool CHECK_BOUNDS, int... TAPS>
+    void diffuse(const int *err, int **rows, int x, int direction, int width, int rows_below,
+                 std::integer_sequence<int, TAPS...>);
+    template <bool CHECK_BOUNDS, int ROW, int COLUMN>
+    void diffuse_tap(const int *err, int **rows, int x, int direction, int width, int rows_below);
 };
 
-template <uint ORDER = 4U>
-class Bayer : DitheringAlgorithm {
-public:
-    Bayer(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false) : DitheringAlgorithm(palette, max_threads, blend_threads) {
-        int BAYER2x2[2][2] = {
+template <typename Kernel>
+void ErrorDiffusion<Kernel>::dither(unsigned char *image, int width, int height, Project *project) {
+    begin_dither(image, width, height);
+    if (cancelled())
+        return;
+
+    // Rows are dithered as a wavefront: worker n handles rows n, n + workers, n + 2*workers...
+    // and each row trails the one above it by ROW_LAG pixels. The order that error is added to
+    // each pixel is unchanged, so the result is identical to dithering sequentially.
+    // Serpentine rows start at the end of the row above, so they can't be overlapped.
+    std::vector<int> error_rows(Kernel::ROWS * width * 3, 0);
+    std::vector<std::atomic<int>> progress(height);
+    int workers = _serpentine ? 1 : std::min(_workers, height);
+
+    auto worker = [&](int first_row) {
+        std::map<RGBcolour, int> cache;
+        for (int y = first_row; y < height && !cancelled(); y += workers) {
+            dither_row(image, width, height, y, error_rows.data(), &progress, &cache, project);
+            row_finished(height);
+        }
+    };
+
+    run_workers(workers, worker);
+
+    if (cancelled())
+        return;
+    commit_stitches(width, height, project);
+}
+
+template <typename Kernel>
+void ErrorDiffusion<Kernel>::dither_row(unsigned char *image, int width, int height, int y, int *error_rows,
+                                        std::vector<std::atomic<int>> *progress, std::map<RGBcolour, int> *cache, Project *project) {
+    // Only Kernel::ROWS rows of error are kept, used as a ring. Each pixel's error is cleared as soon
+    // as it has been read, so a row's buffer is empty again by the time anything writes to its reuse.
+    int *rows[Kernel::ROWS];
+    for (int r = 0; r < Kernel::ROWS; r++)
+        rows[r] = error_rows + (((y + r) % Kernel::ROWS) * width * 3);
+
+    int rows_below = std::min(Kernel::ROWS - 1, height - y - 1);
+    bool all_rows_below = rows_below == Kernel::ROWS - 1;
+    int direction = _serpentine && (y & 1) ? -1 : 1;
+
+    for (int n = 0; n < width; n++) {
+        if (y > 0) {
+            int required = std::min(n + ROW_LAG, width);
+            while ((*progress)[y - 1].load(std::memory_order_acquire) < required) {
+                // The row above stops early when cancelled, so this would wait forever
+                if (cancelled())
+                    return;
+                std::this_thread::yield();
+            }
+        }
+
+        int x = direction == 1 ? n : width - n - 1;
+        if (all_rows_below && x >= MARGIN && x < width - MARGIN)
+            dither_pixel<false>(image, x, y, width, height, direction, rows, rows_below, cache, project);
+        else
+            dither_pixel<true>(image, x, y, width, height, direction, rows, rows_below, cache, project);
+
+        (*progress)[y].store(n + 1, std::memory_order_release);
+    }
+}
+
+template <typename Kernel>
+template <bool CHECK_BOUNDS>
+inline void ErrorDiffusion<Kernel>::dither_pixel(unsigned char *image, int x, int y, int width, int height, int direction,
+                                                 int **rows, int rows_below, std::map<RGBcolour, int> *cache, Project *project) {
+    int i = 4 * INDEX(x, y, width);
+    int *quant_error = rows[0] + (3 * x);
+    int error_R = quant_error[0];
+    int error_G = quant_error[1];
+    int error_B = quant_error[2];
+    quant_error[0] = 0;
+    quant_error[1] = 0;
+    quant_error[2] = 0;
+
+    // Transparent pixels are left blank, and their error is dropped
+    if ((int)image[i+3] == 0)
+        return;
+
+    // Clamp to 0..255
+    RGBcolour old_pixel = RGBcolour{
+        std::clamp(image[i] + error_R, 0, 255),
+        std::clamp(image[i+1] + error_G, 0, 255),
+        std::clamp(image[i+2] + error_B, 0, 255)
+    };
+    int palette_index = find_nearest_index(old_pixel, cache);
+    const RGBcolour& new_pixel = _palette_colours[palette_index];
+
+    // Find the quantisation error and spread it across neighbouring pixels.
+    int err[3] = {
+        old_pixel.R - new_pixel.R,
+        old_pixel.G - new_pixel.G,
+        old_pixel.B - new_pixel.B
+    };
+    diffuse<CHECK_BOUNDS>(err, rows, x, direction, width, rows_below,
+                          std::make_integer_sequence<int, Kernel::ROWS * COLUMNS>{});
+
+    _stitches[INDEX(x, y, width)] = palette_index;
+}
+
+// Expands to one diffuse_tap call per kernel entry, so the loop over the kernel is unrolled
+template <typename Kernel>
+template <bool CHECK_BOUNDS, int... TAPS>
+inline void ErrorDiffusion<Kernel>::diffuse(const int *err, int **rows, int x, int direction, int width, int rows_below,
+                                            std::integer_sequence<int, TAPS...>) {
+    (diffuse_tap<CHECK_BOUNDS, TAPS / COLUMNS, TAPS % COLUMNS>(err, rows, x, direction, width, rows_below), ...);
+}
+
+template <typename Kernel>
+template <bool CHECK_BOUNDS, int ROW, int COLUMN>
+inline void ErrorDiffusion<Kernel>::diffuse_tap(const int *err, int **rows, int x, int direction, int width, int rows_below) {
+    constexpr int weight = Kernel::WEIGHTS[ROW][COLUMN];
+    if constexpr (weight != 0) {
+        constexpr float coefficient = (float)weight / (float)Kernel::DIVISOR;
+        // Serpentine rows mirror the kernel
+        int target_x = x + ((COLUMN - Kernel::LEFT) * direction);
+
+        if constexpr (CHECK_BOUNDS) {
+            if (ROW > rows_below || target_x < 0 || target_x >= width)
+                return;
+        }
+
+        int *target = rows[ROW] + (3 * target_x);
+        target[0] += err[0] * coefficient;
+        target[1] += err[1] * coefficient;
+        target[2] += err[2] * coefficient;
+    }
+}
+
+using FloydSteinburg = ErrorDiffusion<FloydSteinburgKernel>;
+using Atkinson = ErrorDiffusion<AtkinsonKernel>;
+using JarvisJudiceNinke = ErrorDiffusion<JarvisJudiceNinkeKernel>;
+using Stucki = ErrorDiffusion<StuckiKernel>;
+using Sierra = ErrorDiffusion<SierraKernel>;
+
+// Builds the ORDER x ORDER Bayer matrix, indexed [y][x]. Each doubling in size repeats the smaller
+// matrix in four quadrants, multiplied by 4 and offset by the 2x2 matrix.
+template <uint ORDER>
+constexpr std::array<int, ORDER * ORDER> bayer_matrix() {
+    static_assert(ORDER > 0 && (ORDER & (ORDER - 1)) == 0, "ORDER must be a power of two");
+    std::array<int, ORDER * ORDER> matrix{};
+    if constexpr (ORDER > 1) {
+        constexpr uint HALF = ORDER / 2;
+        constexpr int OFFSETS[2][2] = {
             {0, 2},
             {3, 1}
         };
-        int BAYER4x4[4][4] = {
-            { 0,  8,  2, 10},
-            {12,  4, 14,  6},
-            { 3, 11,  1,  9},
-            {15,  7, 13,  5}
-        };
-        int BAYER8x8[8][8] = {
-            { 0, 32,  8, 40,  2, 34, 10, 42},
-            {48, 16, 56, 24, 50, 18, 58, 26},
-            {12, 44,  4, 36, 14, 46,  6, 38},
-            {60, 28, 52, 20, 62, 30, 54, 22},
-            { 3, 35, 11, 43,  1, 33,  9, 41},
-            {51, 19, 59, 27, 49, 17, 57, 25},
-            {15, 47,  7, 39, 13, 45,  5, 37},
-            {63, 31, 55, 23, 61, 29, 53, 21}
-        };
-        int BAYER16x16[16][16] = {
-            {  0, 191,  48, 239,  12, 203,  60, 251,   3, 194,  51, 242,  15, 206,  63, 254},
-            {127,  64, 175, 112, 139,  76, 187, 124, 130,  67, 178, 115, 142,  79, 190, 127},
-            { 32, 223,  16, 207,  44, 235,  28, 219,  35, 226,  19, 210,  47, 238,  31, 222},
-            {159,  96, 143,  80, 171, 108, 155,  92, 162,  99, 146,  83, 174, 111, 158,  95},
-            {  8, 199,  56, 247,   4, 195,  52, 243,  11, 202,  59, 250,   7, 198,  55, 246},
-            {135,  72, 183, 120, 131,  68, 179, 116, 138,  75, 186, 123, 134,  71, 182, 119},
-            { 40, 231,  24, 215,  36, 227,  20, 211,  43, 234,  27, 218,  39, 230,  23, 214},
-            {167, 104, 151,  88, 163, 100, 147,  84, 170, 107, 154,  91, 166, 103, 150,  87},
-            {  2, 193,  50, 241,  14, 205,  62, 253,   1, 192,  49, 240,  13, 204,  61, 252},
-            {129,  66, 177, 114, 141,  78, 189, 126, 128,  65, 176, 113, 140,  77, 188, 125},
-            { 34, 225,  18, 209,  46, 237,  30, 221,  33, 224,  17, 208,  45, 236,  29, 220},
-            {161,  98, 145,  82, 173, 110, 157,  94, 160,  97, 144,  81, 172, 109, 156,  93},
-            { 10, 201,  58, 249,   6, 197,  54, 245,   9, 200,  57, 248,   5, 196,  53, 244},
-            {137,  74, 185, 122, 133,  70, 181, 118, 136,  73, 184, 121, 132,  69, 180, 117},
-            { 42, 233,  26, 217,  38, 229,  22, 213,  41, 232,  25, 216,  37, 228,  21, 212},
-            {169, 106, 153,  90, 165, 102, 149,  86, 168, 105, 152,  89, 164, 101, 148,  85}
-        };
+        std::array<int, HALF * HALF> half = bayer_matrix<HALF>();
+        for (uint y = 0; y < ORDER; y++) {
+            for (uint x = 0; x < ORDER; x++)
+                matrix[y * ORDER + x] = 4 * half[(y % HALF) * HALF + (x % HALF)] + OFFSETS[y / HALF][x / HALF];
+        }
+    }
+    return matrix;
+}
 
-        switch (ORDER) {
-        case BayerOrders::TWO:
-            for (int i = 0; i < ORDER; i++) {
-                for (int j = 0; j < ORDER; j++) {
-                    _matrix[i][j] = THRESHOLD_COLOUR * BAYER2x2[i][j];
-                }
-            }
-            break;
-        case BayerOrders::FOUR:
-            for (int i = 0; i < ORDER; i++) {
-                for (int j = 0; j < ORDER; j++) {
-                    _matrix[i][j] = THRESHOLD_COLOUR * BAYER4x4[i][j];
-                }
-            }
-            break;
-        case BayerOrders::EIGHT:
-            for (int i = 0; i < ORDER; i++) {
-                for (int j = 0; j < ORDER; j++) {
-                    _matrix[i][j] = THRESHOLD_COLOUR * BAYER8x8[i][j];
-                }
-            }
-            break;
-        case BayerOrders::SIXTEEN:
-            for (int i = 0; i < ORDER; i++) {
-                for (int j = 0; j < ORDER; j++) {
-                    _matrix[i][j] = THRESHOLD_COLOUR * BAYER16x16[i][j];
-                }
-            }
-            break;
+template <uint ORDER>
+constexpr std::array<int, ORDER * ORDER> bayer_thresholds() {
+    std::array<int, ORDER * ORDER> thresholds = bayer_matrix<ORDER>();
+    for (int& threshold : thresholds)
+        threshold = rank_to_threshold(threshold, ORDER * ORDER);
+    return thresholds;
+}
 
-        default:
-            throw std::invalid_argument("ORDER must be either 2, 4, 8 or 16");
-            break;
-        }
-    };
+template <uint ORDER = 4U>
+class Bayer : DitheringAlgorithm {
+public:
+    Bayer(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false) : DitheringAlgorithm(palette, max_threads, blend_threads) {};
+
+    using DitheringAlgorithm::set_control;
+    using DitheringAlgorithm::set_prepared_palette;
+    using DitheringAlgorithm::set_mask;
+    using DitheringAlgorithm::set_refine_palette;
+    using DitheringAlgorithm::working_palette;
 
     void dither(unsigned char *image, int width, int height, Project *project);
 
 private:
-    int _matrix[ORDER][ORDER];
+    static constexpr std::array<int, ORDER * ORDER> THRESHOLDS = bayer_thresholds<ORDER>();
 };
 
 template<uint ORDER>
 void Bayer<ORDER>::dither(unsigned char *image, int width, int height, Project *project) {
-    std::vector<Thread*> new_palette;
-    if (_palette->size() > _max_threads) {
-        reduce_palette(image, width, height, &new_palette);
-    }
+    begin_dither(image, width, height);
+    if (cancelled())
+        return;
 
-    std::vector<Thread*> new_new_palette;
-    if (_blend_threads) {
-        expand_palette(&new_new_palette);
-    }
-
-    int i, row, factor;
-    for (int y = 0; y < height; y++) {
-        row = y & ORDER - 1;
-        for (int x = 0; x < width; x++) {
-            i = 4 * INDEX(x, y, width);
-            // It would be ideal to smartly handle opacity. Do not have time
-            // to do this. Any areas that are 100% transparent are blank,
-            // any other opacity level is treated as 100% opaque.
-            if ((int)image[i+3] == 0)
-                continue;
-
-            // TODO: look into normalising threshold matrix, when order is
-            // high the brightness is really bad
-            factor = _matrix[x & ORDER - 1][row];
-            Thread *new_pixel = find_nearest_neighbour(RGBcolour{
-                std::clamp(image[i] + factor, 0, 255), std::clamp(image[i+1] + factor, 0, 255), std::clamp(image[i+2] + factor, 0, 255)
-            }, nullptr);
-
-            draw_stitch(x, y, height, new_pixel, project);
-        }
-    }
+    threshold_dither(image, width, height, project, THRESHOLDS.data(), ORDER);
 }
 
+// Ordered dithering with a void-and-cluster tile instead of a Bayer matrix. It is just as parallel,
+// but the pattern is blue noise, so there is no visible cross hatching.
+class BlueNoise : DitheringAlgorithm {
+public:
+    BlueNoise(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false);
+
+    using DitheringAlgorithm::set_control;
+    using DitheringAlgorithm::set_prepared_palette;
+    using DitheringAlgorithm::set_mask;
+    using DitheringAlgorithm::set_refine_palette;
+    using DitheringAlgorithm::working_palette;
+
+    void dither(unsigned char *image, int width, int height, Project *project);
+
+private:
+    std::vector<int> _matrix;
+};
+
 class NoDither : DitheringAlgorithm {
 public:
     NoDither(std::vector<Thread*> *palette, int max_threads = INT_MAX, bool blend_threads = false) : DitheringAlgorithm(palette, max_threads, blend_threads) {};
 
+    using DitheringAlgorithm::set_control;
+    using DitheringAlgorithm::set_prepared_palette;
+    using DitheringAlgorithm::set_mask;
+    using DitheringAlgorithm::set_refine_palette;
+    using DitheringAlgorithm::working_palette;
+
     void dither(unsigned char *image, int width, int height, Project *project);
-};
\ No newline at end of file
+};
+
+enum AlphaModes {
+    // Partially transparent pixels are blended with the background colour
+    COMPOSITE,
+    // Partially transparent pixels are treated as fully opaque
+    THRESHOLD
+};
+
+// A rectangle of pixels, x and y being the top left corner
+struct DitheringRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// A mask for DitheringAlgorithm::set_mask covering the regions, clipped to the image
+std::vector<unsigned char> mask_from_regions(int width, int height, const std::vector<DitheringRegion>& regions);
+
+struct DitheringSettings {
+    int algorithm = DitheringAlgorithms::FLOYD_STEINBURG;
+    // Only used by Bayer
+    int bayer_order = BayerOrders::FOUR;
+    // Only used by the error diffusion algorithms
+    bool serpentine = false;
+    bool blend_threads = false;
+    int max_threads = INT_MAX;
+    int alpha_mode = AlphaModes::COMPOSITE;
+    // Only used by THRESHOLD, pixels with an alpha below this (0..255) are left blank
+    int alpha_cutoff = 128;
+    // Only used when max_threads reduces the palette, see DitheringAlgorithm::set_refine_palette
+    bool refine_palette = true;
+};
+
+// Leaves every pixel in image either fully transparent, which is left blank, or fully opaque.
+// When compositing, only pixels with no alpha are left transparent and the colour of the rest is
+// blended with background by its alpha. When thresholding, pixels with an alpha below alpha_cutoff
+// are left transparent and the rest keep their colour.
+void prepare_alpha(unsigned char *image, int width, int height, int alpha_mode, int alpha_cutoff, nanogui::Color background);
+
+/* Dithers image into project with the algorithm chosen in settings, after handling its transparency
+in place with prepare_alpha. The image must be the same size as the project, which doesn't have to be
+empty. If mask is given only those pixels are dithered, see DitheringAlgorithm::set_mask. control is optional, see
+DitheringAlgorithm::set_control. If prepared_palette is given and isn't empty it is used instead of
+reducing or blending palette, if it is empty it is filled with the palette that ended up being used.
+Throws std::invalid_argument if the algorithm or Bayer order isn't recognised, or the sizes don't match. */
+void dither_image(const DitheringSettings& settings, std::vector<Thread*> *palette, unsigned char *image, int width, int height,
+                  Project *project, DitheringControl *control = nullptr, std::vector<Thread*> *prepared_palette = nullptr,
+                  const unsigned char *mask = nullptr);
@@ -0,0 +1,106 @@
+#include "dithering_preview.hpp"
+#include "project.hpp"
+#include "threads.hpp"
+
+DitheringPreview::DitheringPreview(ResultCallback on_result) : _on_result(on_result) {
+    _thread = std::thread(&DitheringPreview::run, this);
+}
+
+DitheringPreview::~DitheringPreview() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _control.cancelled = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+void DitheringPreview::request(int image_id, std::vector<unsigned char> image, int width, int height, std::vector<Thread*> palette,
+                               const DitheringSettings& settings, nanogui::Color background) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending = Request{image_id, std::move(image), width, height, std::move(palette), settings, background};
+        _control.cancelled = true;
+    }
+    _wake.notify_one();
+}
+
+void DitheringPreview::run() {
+    while (true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]() { return _stopping || _pending.has_value(); });
+            if (_stopping)
+                return;
+
+            request = std::move(*_pending);
+            _pending.reset();
+            // Reset under the lock, so a request made from now on will cancel this one
+            _control.cancelled = false;
+        }
+
+        dither(&request);
+    }
+}
+
+void DitheringPreview::dither(Request *request) {
+    bool cache_valid = !_cached_palette.empty() && request->image_id == _cached_image_id &&
+                       request->palette == _cached_source_palette &&
+                       request->settings.max_threads == _cached_max_threads &&
+                       request->settings.blend_threads == _cached_blend_threads &&
+                       request->settings.refine_palette == _cached_refine_palette &&
+                       request->settings.alpha_mode == _cached_alpha_mode &&
+                       request->settings.alpha_cutoff == _cached_alpha_cutoff &&
+                       request->background == _cached_background;
+    if (!cache_valid) {
+        _cached_palette.clear();
+        _cached_image_id = request->image_id;
+        _cached_source_palette = request->palette;
+        _cached_max_threads = request->settings.max_threads;
+        _cached_blend_threads = request->settings.blend_threads;
+        _cached_refine_palette = request->settings.refine_palette;
+        _cached_alpha_mode = request->settings.alpha_mode;
+        _cached_alpha_cutoff = request->settings.alpha_cutoff;
+        _cached_background = request->background;
+    }
+
+    Project project("Preview", request->width, request->height, request->background);
+    try {
+        dither_image(request->settings, &request->palette, request->image.data(), request->width, request->height,
+                     &project, &_control, &_cached_palette);
+    } catch (const std::invalid_argument& err) {
+        return;
+    }
+
+    std::vector<unsigned char> image;
+    if (!_control.cancelled) {
+        image.resize(request->width * request->height * 4);
+        int background[3] = {
+            color_float_to_int(request->background.r()),
+            color_float_to_int(request->background.g()),
+            color_float_to_int(request->background.b())
+        };
+        for (int y = 0; y < request->height; y++) {
+            for (int x = 0; x < request->width; x++) {
+                unsigned char *pixel = &image[4 * INDEX(x, y, request->width)];
+                int palette_index = project.thread_data[x][request->height - y - 1];
+                if (palette_index == -1) {
+                    pixel[0] = background[0];
+                    pixel[1] = background[1];
+                    pixel[2] = background[2];
+                } else {
+                    Thread *thread = project.palette[palette_index];
+                    pixel[0] = thread->R;
+                    pixel[1] = thread->G;
+                    pixel[2] = thread->B;
+                }
+                pixel[3] = 255;
+            }
+        }
+    }
+
+    if (!_control.cancelled)
+        _on_result(request->image_id, std::move(image), request->width, request->height);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <optional>
+#include <nanogui/vector.h>
+#include "dithering.hpp"
+
+// Dithers small images on a background thread, so that the dithering window can show what the
+// current settings look like. Only the newest request is worked on, making a request cancels
+// whatever is in progress.
+class DitheringPreview {
+public:
+    // Called on the preview thread with the dithered image, as top to bottom rows of RGBA
+    using ResultCallback = std::function<void(int image_id, std::vector<unsigned char> image, int width, int height)>;
+
+    DitheringPreview(ResultCallback on_result);
+    ~DitheringPreview();
+
+    // image_id should change whenever the contents of image do. The reduced/blended palette is
+    // reused while the image, palette, maximum threads, blending and transparency settings and
+    // background stay the same.
+    void request(int image_id, std::vector<unsigned char> image, int width, int height, std::vector<Thread*> palette,
+                 const DitheringSettings& settings, nanogui::Color background);
+
+private:
+    struct Request {
+        int image_id;
+        std::vector<unsigned char> image;
+        int width;
+        int height;
+        std::vector<Thread*> palette;
+        DitheringSettings settings;
+        nanogui::Color background;
+    };
+
+    void run();
+    void dither(Request *request);
+
+    ResultCallback _on_result;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::optional<Request> _pending;
+    bool _stopping = false;
+    DitheringControl _control;
+    std::thread _thread;
+
+    // Only touched by the preview thread
+    std::vector<Thread*> _cached_palette;
+    int _cached_image_id = -1;
+    std::vector<Thread*> _cached_source_palette;
+    int _cached_max_threads = 0;
+    bool _cached_blend_threads = false;
+    bool _cached_refine_palette = true;
+    int _cached_alpha_mode = 0;
+    int _cached_alpha_cutoff = 0;
+    nanogui::Color _cached_background;
+};
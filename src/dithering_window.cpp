@@ -1,18 +1,31 @@
 #include "dithering_window.hpp"
 #include "x_stitch_editor.hpp"
-#define STB_IMAGE_IMPLEMENTATION
-#define STBI_FAILURE_USERMSG
-#include "stb_image.h"
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize2.h"
+#include "image_source.hpp"
 #include "dithering.hpp"
+#include "dithering_preview.hpp"
+#include "catalogue.hpp"
 #include "constants.hpp"
-#include <iostream>
-#include <chrono>
-
-using namespace std::chrono;
-
-std::vector<std::pair<std::string, std::string>> permitted_image_files = {{"png", ""}, {"jpg", ""}, {"jpeg", ""}};
+#include "profiler.hpp"
+#include <atomic>
+
+// Longest side of the image the preview dithers, small enough to update as settings change
+#define PREVIEW_SIZE 128
+// Longest side of the copy of the source image kept for making previews
+#define PREVIEW_SOURCE_SIZE 512
+// Number of steps the progress bar moves in while dithering, each one draws a frame
+#define PROGRESS_STEPS 100
+
+// State shared between the window and the thread running a dither
+struct DitheringJob {
+    DitheringControl control;
+    std::atomic<int> stage = DitheringStage::REDUCING_PALETTE;
+    std::atomic<int> rows_done = 0;
+    std::atomic<int> rows_total = 0;
+    // Set by the job thread if it fails, only read once it has finished
+    std::string error;
+};
+
+std::vector<std::pair<std::string, std::string>> permitted_image_files = {{"png", ""}, {"jpg", ""}, {"jpeg", ""}, {"tif", ""}, {"tiff", ""}};
 
 void DitheringWindow::initialise() {
     using namespace nanogui;
@@ -41,20 +54,20 @@ void DitheringWindow::initialise() {
     Label *width_label = new Label(dimensions_widget, "Width:");
     _width_intbox = new IntBox(dimensions_widget, 0);
     _width_intbox->set_callback([this](int width) {
-        if (!_aspect_ratio_button->pushed())
-            return;
-
-        float ratio = (float)_height / (float)_width;
-        _height_intbox->set_value(width * ratio);
+        if (_aspect_ratio_button->pushed()) {
+            float ratio = (float)_height / (float)_width;
+            _height_intbox->set_value(width * ratio);
+        }
+        update_preview();
     });
     Label *height_label = new Label(dimensions_widget, "Height:");
     _height_intbox = new IntBox(dimensions_widget, 0);
     _height_intbox->set_callback([this](int height) {
-        if (!_aspect_ratio_button->pushed())
-            return;
-
-        float ratio = (float)_width / (float)_height;
-        _width_intbox->set_value(height * ratio);
+        if (_aspect_ratio_button->pushed()) {
+            float ratio = (float)_width / (float)_height;
+            _width_intbox->set_value(height * ratio);
+        }
+        update_preview();
     });
     for (auto intbox : {_width_intbox, _height_intbox}) {
         intbox->set_fixed_width(142);
@@ -68,6 +81,7 @@ void DitheringWindow::initialise() {
     reset_dimensions_button->set_callback([this]() {
         _width_intbox->set_value(_width);
         _height_intbox->set_value(_height);
+        update_preview();
     });
 
     using Anchor = AdvancedGridLayout::Anchor;
@@ -80,43 +94,82 @@ void DitheringWindow::initialise() {
     dimensions_layout->set_anchor(_aspect_ratio_button, Anchor(4, 0));
     dimensions_layout->set_anchor(reset_dimensions_button, Anchor(4, 2));
 
-    // TODO: Add control for upscaling algorithm (bicubic, point sample)
-    // should only appear if user has selected dimensions greater than the input image
-    // (STBIR_FILTER_DEFAULT, STBIR_FILTER_POINT_SAMPLE)
+    // RESIZE FILTER
+    new Label(form_widget, "Resize filter:");
+    Widget *resize_filter_widget = new Widget(form_widget);
+    resize_filter_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Fill, 0, 5));
+    _resize_filter_combobox = new ComboBox(resize_filter_widget, std::vector<std::string>{"Automatic", "Box", "Mitchell", "Lanczos"});
+    _resize_filter_combobox->set_callback([this](int index_selected) {
+        _app->perform_layout();
+        update_preview();
+    });
+    _resize_filter_combobox->set_fixed_width(200);
+    Button *resize_filter_info_button = new Button(resize_filter_widget, "", FA_INFO);
+    resize_filter_info_button->set_tooltip("How the image is scaled to the project's dimensions. Box averages the pixels each stitch covers, which is soft but keeps flat areas of colour clean. Lanczos keeps the most detail when shrinking photos, at the cost of slight halos around edges. Mitchell is in between, Automatic uses Mitchell when shrinking and Catmull-Rom when enlarging.");
+    resize_filter_info_button->set_enabled(false);
 
     // CANVAS BACKGROUND COLOUR
     new Label(form_widget, "Canvas background colour:");
     _color_picker = new ColorPicker(form_widget, CANVAS_DEFAULT_COLOR);
+    _color_picker->set_callback([this](const Color& color) { update_preview(); });
+
+    // TRANSPARENCY
+    new Label(form_widget, "Transparency:");
+    Widget *transparency_widget = new Widget(form_widget);
+    transparency_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Fill, 0, 5));
+    _alpha_mode_combobox = new ComboBox(transparency_widget, std::vector<std::string>{"Blend with background", "Cut out"});
+    _alpha_mode_combobox->set_callback([this](int index_selected) {
+        bool threshold = index_selected == AlphaModes::THRESHOLD;
+        _alpha_cutoff_label->set_visible(threshold);
+        _alpha_cutoff_intbox->set_visible(threshold);
+        _app->perform_layout();
+        update_preview();
+    });
+    _alpha_mode_combobox->set_fixed_width(200);
+    Button *transparency_info_button = new Button(transparency_widget, "", FA_INFO);
+    transparency_info_button->set_tooltip("Fully transparent pixels are always left blank. Blend with background mixes the colour of the rest with the canvas background colour according to how transparent they are, which suits soft edges and shadows. Cut out leaves pixels less opaque than the cutoff blank and keeps the colour of the rest as it is, which suits images with hard edged transparency.");
+    transparency_info_button->set_enabled(false);
+    _alpha_cutoff_label = new Label(form_widget, "Transparency cutoff:");
+    _alpha_cutoff_intbox = new IntBox<int>(form_widget, 50);
+    _alpha_cutoff_intbox->set_default_value("50");
+    _alpha_cutoff_intbox->set_units("% opaque");
+    _alpha_cutoff_intbox->set_max_value(100);
+    _alpha_cutoff_intbox->set_callback([this](int cutoff) { update_preview(); });
+    // Only cutting out uses the cutoff
+    _alpha_cutoff_label->set_visible(false);
+    _alpha_cutoff_intbox->set_visible(false);
 
     // ALGORITHM
     new Label(form_widget, "Algorithm:");
     Widget *algorithm_widget = new Widget(form_widget);
     algorithm_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Fill, 0, 5));
-    _algorithm_combobox = new ComboBox(algorithm_widget, std::vector<std::string>{"Floyd-Steinburg", "Bayer", "Quantise"});
+    _algorithm_combobox = new ComboBox(algorithm_widget, std::vector<std::string>{
+        "Floyd-Steinburg", "Atkinson", "Jarvis-Judice-Ninke", "Stucki", "Sierra", "Bayer", "Blue Noise", "Quantise"});
     _algorithm_combobox->set_callback([this](int index_selected) {
+        bool error_diffusion = index_selected < DitheringAlgorithms::BAYER;
+        _serpentine_label->set_visible(error_diffusion);
+        _serpentine_checkbox->set_visible(error_diffusion);
+        bool bayer = index_selected == DitheringAlgorithms::BAYER;
+        _matrix_size_label->set_visible(bayer);
+        _matrix_size_widget->set_visible(bayer);
         _app->perform_layout();
-        if (index_selected == DitheringAlgorithms::BAYER) {
-            _matrix_size_label->set_visible(true);
-            _matrix_size_widget->set_visible(true);
-            _app->perform_layout();
-        } else if (_matrix_size_label->visible() || _matrix_size_widget->visible()) {
-            _matrix_size_label->set_visible(false);
-            _matrix_size_widget->set_visible(false);
-            _app->perform_layout();
-        }
+        update_preview();
     });
     _algorithm_combobox->set_fixed_width(200);
     Button *algorithm_info_button = new Button(algorithm_widget, "", FA_INFO);
-    algorithm_info_button->set_tooltip("Different algorithms are more suited for different applications. For images that mostly contain flat colours and no gradients Quantising is suited. Floyd-Steinburg is good for conversion of photographs or other 'busy' images. Bayer has a distinct cross hatch style which is good for creating a retro effect.");
+    algorithm_info_button->set_tooltip("Different algorithms are more suited for different applications. For images that mostly contain flat colours and no gradients Quantising is suited. Floyd-Steinburg is good for conversion of photographs or other 'busy' images. Jarvis-Judice-Ninke, Stucki and Sierra spread the error further for smoother gradients, and Atkinson keeps more contrast. Bayer has a distinct cross hatch style which is good for creating a retro effect. Blue Noise is as fast as Bayer but the pattern looks like fine grain instead of a cross hatch.");
     algorithm_info_button->set_enabled(false);
 
     // THRESHOLD MATRIX
     _matrix_size_label = new Label(form_widget, "Matrix Size:");
     _matrix_size_widget = new Widget(form_widget);
     _matrix_size_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Fill, 0, 5));
-    _matrix_size_combobox = new ComboBox(_matrix_size_widget, std::vector<std::string>{"2", "4", "8", "16"});
+    _matrix_size_combobox = new ComboBox(_matrix_size_widget, std::vector<std::string>{"2", "4", "8", "16", "32", "64"});
     _matrix_size_combobox->set_selected_index(1);
-    _matrix_size_combobox->set_callback([this](int index_selected) { _app->perform_layout(); });
+    _matrix_size_combobox->set_callback([this](int index_selected) {
+        _app->perform_layout();
+        update_preview();
+    });
     _matrix_size_combobox->set_fixed_width(200);
     Button *matrix_info_button = new Button(_matrix_size_widget, "", FA_INFO);
     matrix_info_button->set_tooltip("This setting controls the size of the threshold matrix used to perform Bayer dithering. As the matrix size increases, the resulting image will become brighter. Banding will be quite noticeable at size 2, and the patterns are most recognisable at size 4.");
@@ -126,12 +179,18 @@ void DitheringWindow::initialise() {
     _matrix_size_label->set_visible(false);
     _matrix_size_widget->set_visible(false);
 
+    // SERPENTINE SCANNING
+    _serpentine_label = new Label(form_widget, "Serpentine scanning:");
+    _serpentine_checkbox = new CheckBox(form_widget, "");
+    _serpentine_checkbox->set_callback([this](bool checked) { update_preview(); });
+    _serpentine_checkbox->set_tooltip("Alternates the direction each row is dithered in, which breaks up the diagonal artifacts error diffusion can leave. Rows can't be dithered in parallel with this enabled, so it is slower.");
+
     // PALETTE
     new Label(form_widget, "Threads available:");
     Widget *palette_widget = new Widget(form_widget);
     palette_widget->set_layout(new BoxLayout(Orientation::Vertical, Alignment::Fill, 0, 5));
-    for (const auto & [manufacturer_name, threads_map] : _app->_threads)
-        _palette_checkboxes.push_back(new CheckBox(palette_widget, manufacturer_name));
+    for (const std::string& manufacturer_name : _app->_catalogues->names())
+        _palette_checkboxes.push_back(new CheckBox(palette_widget, manufacturer_name, [this](bool checked) { update_preview(); }));
     CheckBox *first = nullptr;
     first = _palette_checkboxes.at(0);
     if (first != nullptr)
@@ -144,6 +203,7 @@ void DitheringWindow::initialise() {
     // ENABLE THREAD BLENDING
     new Label(form_widget, "Enable thread blending:");
     _enable_thread_blending_checkbox = new CheckBox(form_widget, "");
+    _enable_thread_blending_checkbox->set_callback([this](bool checked) { update_preview(); });
 
     // ENABLE MAX THREADS
     new Label(form_widget, "Enable setting a maximum NO threads:");
@@ -152,6 +212,7 @@ void DitheringWindow::initialise() {
         _max_threads_label->set_visible(checked);
         _max_threads_intbox->set_visible(checked);
         _app->perform_layout();
+        update_preview();
     });
 
     // MAX THREADS
@@ -162,36 +223,81 @@ void DitheringWindow::initialise() {
     _max_threads_intbox = new IntBox<int>(form_widget, 50);
     _max_threads_intbox->set_default_value("50");
     _max_threads_intbox->set_visible(false);
+    _max_threads_intbox->set_callback([this](int max_threads) { update_preview(); });
+
+    // PREVIEW
+    new Label(form_widget, "Preview:");
+    _preview_view = new ImageView(form_widget);
+    _preview_view->set_fixed_size(Vector2i(200, 200));
+    _preview_view->set_visible(false);
 
-    for (auto intbox : {_width_intbox, _height_intbox, _max_threads_intbox}) {
+    for (auto intbox : {_width_intbox, _height_intbox, _max_threads_intbox, _alpha_cutoff_intbox}) {
         intbox->set_editable(true);
         intbox->set_spinnable(true);
         intbox->set_alignment(TextBox::Alignment::Left);
         intbox->set_min_value(1);
     }
 
-    Button *button = new Button(this, "Create pattern");
-    button->set_callback([this]() {
+    _create_button = new Button(this, "Create pattern");
+    _create_button->set_callback([this]() {
         create_pattern();
     });
 
-    // TODO: A second "Preview" button would be a very good feature,
-    // just a pop-up that displays the result of the currently
-    // selected settings
+    _progress_widget = new Widget(this);
+    _progress_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Middle, 0, 10));
+    _progress_label = new Label(_progress_widget, "");
+    _progress_label->set_fixed_width(130);
+    _progress_bar = new ProgressBar(_progress_widget);
+    _progress_bar->set_fixed_width(200);
+    Button *cancel_button = new Button(_progress_widget, "Cancel");
+    cancel_button->set_callback([this]() {
+        cancel_job();
+    });
+    _progress_widget->set_visible(false);
+
+    _preview = std::make_unique<DitheringPreview>([this](int image_id, std::vector<unsigned char> image, int width, int height) {
+        nanogui::async([this, image_id, image = std::move(image), width, height]() {
+            show_preview(image_id, image, width, height);
+        });
+    });
 
     center();
 }
 
+// Defined here rather than in the header as DitheringPreview is incomplete there
+DitheringWindow::DitheringWindow(nanogui::Widget *parent) : _app((XStitchEditorApplication*)parent), nanogui::Window(parent, "") {};
+
+DitheringWindow::~DitheringWindow() {
+    cancel_job();
+    if (_job_thread.joinable())
+        _job_thread.join();
+}
+
 void DitheringWindow::reset_form() {
+    // The job owns the image, so it has to finish before the image can be freed
+    cancel_job();
+    if (_job_thread.joinable())
+        _job_thread.join();
+    _job = nullptr;
+    show_progress(false);
+
     _errors->set_visible(false);
     _title_entry->set_value("");
     _aspect_ratio_button->set_pushed(true);
     _color_picker->set_color(CANVAS_DEFAULT_COLOR);
     _color_picker->set_pushed(false);
+    _resize_filter_combobox->set_selected_index(ResizeFilters::AUTOMATIC);
+    _alpha_mode_combobox->set_selected_index(AlphaModes::COMPOSITE);
+    _alpha_cutoff_intbox->set_value(50);
+    _alpha_cutoff_label->set_visible(false);
+    _alpha_cutoff_intbox->set_visible(false);
     _algorithm_combobox->set_selected_index(0);
     _matrix_size_label->set_visible(false);
     _matrix_size_widget->set_visible(false);
     _matrix_size_combobox->set_selected_index(1);
+    _serpentine_label->set_visible(true);
+    _serpentine_checkbox->set_visible(true);
+    _serpentine_checkbox->set_checked(false);
 
     nanogui::CheckBox *cb;
     for (int i = 0; i < _palette_checkboxes.size(); i++) {
@@ -205,12 +311,16 @@ void DitheringWindow::reset_form() {
     _max_threads_intbox->set_visible(false);
     _max_threads_intbox->set_value(50);
 
-    if (_image != nullptr) {
-        stbi_image_free(_image);
-        _image = nullptr;
-        _width = 0;
-        _height = 0;
-    }
+    _source = nullptr;
+    _width = 0;
+    _height = 0;
+
+    _preview_source.clear();
+    _preview_image.clear();
+    _preview_width = 0;
+    _preview_height = 0;
+    _preview_image_id++;
+    _preview_view->set_visible(false);
 }
 
 void DitheringWindow::select_image() {
@@ -220,18 +330,21 @@ void DitheringWindow::select_image() {
         return;
     }
 
-    int no_channels;
-
-    // Freeing just incase, ideally all exit points from the window would clear this first
-    if (_image != nullptr) {
-        stbi_image_free(_image);
-        _image = nullptr;
-    }
-
-    _image = stbi_load(path.c_str(), &_width, &_height, &no_channels, 4); // requesting 4 channels
-
-    if (_image == nullptr) {
-        new nanogui::MessageDialog(_app, nanogui::MessageDialog::Type::Warning, "Error loading image", stbi_failure_reason());
+    try {
+        PROFILE_SCOPE("load image");
+        _source = open_image(path);
+        _width = _source->width();
+        _height = _source->height();
+
+        // Resizing the full image for every preview would be too slow for big photos
+        float scale = std::min(1.f, (float)PREVIEW_SOURCE_SIZE / std::max(_width, _height));
+        _preview_source_width = std::max(1, (int)(_width * scale));
+        _preview_source_height = std::max(1, (int)(_height * scale));
+        _preview_source.resize(_preview_source_width * _preview_source_height * 4);
+        resize_image(_source.get(), _preview_source.data(), _preview_source_width, _preview_source_height);
+    } catch (const std::runtime_error& err) {
+        _source = nullptr;
+        new nanogui::MessageDialog(_app, nanogui::MessageDialog::Type::Warning, "Error loading image", err.what());
         _app->switch_application_state(ApplicationStates::LAUNCH);
         return;
     }
@@ -240,23 +353,13 @@ void DitheringWindow::select_image() {
     _width_intbox->set_default_value(std::to_string(_width));
     _height_intbox->set_value(_height);
     _height_intbox->set_default_value(std::to_string(_height));
-}
 
-void DitheringWindow::create_pattern() {
-    _errors->set_visible(false);
-    _app->perform_layout();
-    // read and validate user input
-    int max_threads = INT_MAX;
-    if (_enable_max_threads_checkbox->checked()) {
-        max_threads = _max_threads_intbox->value();
-        if (max_threads < 1) {
-            _errors->set_visible(true);
-            _errors->set_caption("The maximum NO threads must be 1 or greater");
-            _app->perform_layout();
-            return;
-        }
-    }
+    _preview_width = 0;
+    _preview_height = 0;
+    update_preview();
+}
 
+std::vector<Thread*> DitheringWindow::selected_palette() {
     std::vector<Thread*> palette;
 
     nanogui::CheckBox *cb;
@@ -265,15 +368,50 @@ void DitheringWindow::create_pattern() {
         if (!cb->checked())
             continue;
 
-        auto manufacturer = _app->_threads.begin();
-        std::advance(manufacturer, i);
-        auto threads = manufacturer->second;
+        // Loads the manufacturer's threads if they haven't been already
+        ThreadCatalogue *catalogue = _app->_catalogues->catalogue(_app->_catalogues->names()[i]);
+        if (catalogue == nullptr)
+            continue;
 
-        for (const auto & [key, thread] : *threads) {
-            palette.push_back(thread);
-        }
+        for (SingleThread& thread : catalogue->threads())
+            palette.push_back(&thread);
+    }
+
+    return palette;
+}
+
+DitheringSettings DitheringWindow::selected_settings() {
+    DitheringSettings settings;
+    settings.algorithm = _algorithm_combobox->selected_index();
+    // The matrix sizes listed are 2, 4, 8...
+    settings.bayer_order = 2 << _matrix_size_combobox->selected_index();
+    settings.serpentine = _serpentine_checkbox->checked();
+    settings.blend_threads = _enable_thread_blending_checkbox->checked();
+    if (_enable_max_threads_checkbox->checked())
+        settings.max_threads = _max_threads_intbox->value();
+    settings.alpha_mode = _alpha_mode_combobox->selected_index();
+    // The cutoff is shown as a percentage, rounding up so 1% still leaves fully transparent pixels blank
+    settings.alpha_cutoff = ((std::clamp(_alpha_cutoff_intbox->value(), 1, 100) * 255) + 99) / 100;
+    return settings;
+}
+
+void DitheringWindow::create_pattern() {
+    if (_job != nullptr)
+        return;
+
+    _errors->set_visible(false);
+    _app->perform_layout();
+    // read and validate user input
+    DitheringSettings settings = selected_settings();
+    if (settings.max_threads < 1) {
+        _errors->set_visible(true);
+        _errors->set_caption("The maximum NO threads must be 1 or greater");
+        _app->perform_layout();
+        return;
     }
 
+    std::vector<Thread*> palette = selected_palette();
+
     if (palette.size() < 0) {
         _errors->set_visible(true);
         _errors->set_caption("Please select atleast one thread palette (e.g. DMC, Anchor, etc)");
@@ -292,72 +430,176 @@ void DitheringWindow::create_pattern() {
         return;
     }
 
-    // Resizing image if necessary
-    int user_width = _width_intbox->value();
-    int user_height = _height_intbox->value();
-    if (_width != user_width || _height != user_height) {
-        unsigned char *resized_image = nullptr;
-        resized_image = stbir_resize_uint8_srgb(_image, _width, _height, 0, NULL, user_width, user_height, 0, stbir_pixel_layout::STBIR_RGBA);
-
-        if (resized_image != nullptr) {
-            stbi_image_free(_image);
-            _image = resized_image;
-            _width = user_width;
-            _height = user_height;
-        } else {
-            _errors->set_visible(true);
-            _errors->set_caption("Error resizing image");
-            _app->perform_layout();
-            return;
-        }
+    std::shared_ptr<DitheringJob> job = std::make_shared<DitheringJob>();
+    // Not capturing the shared pointer, the control is part of the job so that would be a cycle
+    DitheringJob *job_state = job.get();
+    XStitchEditorApplication *app = _app;
+    job->control.progress = [job_state, app](DitheringStage stage, int rows_done, int rows_total) {
+        int previous_stage = job_state->stage.exchange(stage, std::memory_order_relaxed);
+        int previous_rows_done = job_state->rows_done.exchange(rows_done, std::memory_order_relaxed);
+        job_state->rows_total.store(rows_total, std::memory_order_relaxed);
+
+        // Frames are drawn on demand, so ask for one whenever the progress bar would visibly move
+        if (stage != previous_stage || (rows_total > 0 &&
+            (previous_rows_done * PROGRESS_STEPS) / rows_total != (rows_done * PROGRESS_STEPS) / rows_total))
+            nanogui::async([app]() { app->redraw(); });
+    };
+
+    _job = job;
+    show_progress(true);
+
+    int width = project->width;
+    int height = project->height;
+    ResizeFilters filter = (ResizeFilters)_resize_filter_combobox->selected_index();
+    _job_thread = std::thread([this, job, settings, width, height, filter, palette = std::move(palette), project]() mutable {
+        run_job(job.get(), settings, width, height, filter, &palette, project);
+        nanogui::async([this, job, project]() {
+            finish_job(job, project);
+        });
+    });
+}
+
+void DitheringWindow::run_job(DitheringJob *job, const DitheringSettings& settings, int width, int height, ResizeFilters filter,
+                              std::vector<Thread*> *palette, Project *project) {
+    // The source is read a strip at a time, so only the image at the project's size is ever
+    // held in full
+    std::vector<unsigned char> image((size_t)width * height * 4);
+    try {
+        PROFILE_SCOPE("resize image");
+        resize_image(_source.get(), image.data(), width, height, filter);
+    } catch (const std::runtime_error& err) {
+        job->error = err.what();
+        return;
     }
 
-    auto start = high_resolution_clock::now();
-
-    int selected_algorithm = _algorithm_combobox->selected_index();
-    if (selected_algorithm == DitheringAlgorithms::FLOYD_STEINBURG) {
-        FloydSteinburg floyd_steinburg(&palette, max_threads, _enable_thread_blending_checkbox->checked());
-        floyd_steinburg.dither(_image, _width, _height, project);
-    } else if (selected_algorithm == DitheringAlgorithms::BAYER) {
-        int selected_matrix = _matrix_size_combobox->selected_index();
-        if (selected_matrix == 0) {
-            Bayer<BayerOrders::TWO> bayer(&palette, max_threads, _enable_thread_blending_checkbox->checked());
-            bayer.dither(_image, _width, _height, project);
-        } else if (selected_matrix == 1) {
-            Bayer<BayerOrders::FOUR> bayer(&palette, max_threads, _enable_thread_blending_checkbox->checked());
-            bayer.dither(_image, _width, _height, project);
-        } else if (selected_matrix == 2) {
-            Bayer<BayerOrders::EIGHT> bayer(&palette, max_threads, _enable_thread_blending_checkbox->checked());
-            bayer.dither(_image, _width, _height, project);
-        } else if (selected_matrix == 3) {
-            Bayer<BayerOrders::SIXTEEN> bayer(&palette, max_threads, _enable_thread_blending_checkbox->checked());
-            bayer.dither(_image, _width, _height, project);
-        } else {
-            delete project;
-            _errors->set_visible(true);
-            _errors->set_caption("The matrix size selected is not recognised, please try another");
-            _app->perform_layout();
-            return;
-        }
-    } else if (selected_algorithm == DitheringAlgorithms::QUANTISE) {
-        NoDither no_dither(&palette, max_threads, _enable_thread_blending_checkbox->checked());
-        no_dither.dither(_image, _width, _height, project);
-    } else {
+    try {
+        PROFILE_SCOPE("dither image");
+        dither_image(settings, palette, image.data(), width, height, project, &job->control);
+    } catch (const std::invalid_argument& err) {
+        job->error = err.what();
+    }
+}
+
+void DitheringWindow::finish_job(std::shared_ptr<DitheringJob> job, Project *project) {
+    _app->redraw();
+
+    // reset_form may have already waited for this job and moved on
+    if (job != _job) {
+        delete project;
+        return;
+    }
+
+    _job_thread.join();
+    _job = nullptr;
+    show_progress(false);
+
+    if (job->control.cancelled) {
+        delete project;
+        return;
+    }
+
+    if (!job->error.empty()) {
         delete project;
         _errors->set_visible(true);
-        _errors->set_caption("The algorithm selected is not recognised, please try another");
+        _errors->set_caption(job->error);
         _app->perform_layout();
         return;
     }
 
-    auto end = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(end - start);
-    std::cout << "Time elapsed dithering: " << duration.count() << "ms" << std::endl;
-
     _app->switch_project(project);
     _app->switch_application_state(ApplicationStates::PROJECT_OPEN);
-    stbi_image_free(_image);
-    _image = nullptr;
+    _source = nullptr;
     _width = 0;
     _height = 0;
+}
+
+void DitheringWindow::cancel_job() {
+    if (_job != nullptr)
+        _job->control.cancelled = true;
+}
+
+void DitheringWindow::show_progress(bool visible) {
+    _create_button->set_enabled(!visible);
+    _progress_widget->set_visible(visible);
+    _progress_label->set_caption("");
+    _progress_bar->set_value(0.f);
+    _app->perform_layout();
+}
+
+void DitheringWindow::draw(NVGcontext *ctx) {
+    if (_job != nullptr) {
+        int stage = _job->stage.load(std::memory_order_relaxed);
+        int rows_total = _job->rows_total.load(std::memory_order_relaxed);
+        std::string caption;
+        if (_job->control.cancelled) {
+            caption = "Cancelling...";
+        } else if (stage == DitheringStage::REDUCING_PALETTE) {
+            caption = "Reducing palette...";
+        } else if (stage == DitheringStage::BLENDING_THREADS) {
+            caption = "Blending threads...";
+        } else {
+            caption = "Dithering...";
+        }
+        if (caption != _progress_label->caption()) {
+            _progress_label->set_caption(caption);
+            _app->perform_layout();
+        }
+        _progress_bar->set_value(stage == DitheringStage::DITHERING && rows_total > 0
+                                 ? (float)_job->rows_done.load(std::memory_order_relaxed) / rows_total : 0.f);
+    }
+
+    nanogui::Window::draw(ctx);
+}
+
+void DitheringWindow::update_preview() {
+    if (_preview_source.empty())
+        return;
+
+    int width = _width_intbox->value();
+    int height = _height_intbox->value();
+    std::vector<Thread*> palette = selected_palette();
+    DitheringSettings settings = selected_settings();
+    if (width < 1 || height < 1 || palette.empty() || settings.max_threads < 1)
+        return;
+
+    // The preview keeps the project's aspect ratio, and is never bigger than the project
+    float scale = std::min(1.f, (float)PREVIEW_SIZE / std::max(width, height));
+    int preview_width = std::max(1, (int)(width * scale));
+    int preview_height = std::max(1, (int)(height * scale));
+    ResizeFilters filter = (ResizeFilters)_resize_filter_combobox->selected_index();
+    if (preview_width != _preview_width || preview_height != _preview_height || filter != _preview_filter) {
+        _preview_image.resize(preview_width * preview_height * 4);
+        BufferImageSource source(_preview_source.data(), _preview_source_width, _preview_source_height);
+        resize_image(&source, _preview_image.data(), preview_width, preview_height, filter);
+        _preview_width = preview_width;
+        _preview_height = preview_height;
+        _preview_filter = filter;
+        _preview_image_id++;
+    }
+
+    _preview->request(_preview_image_id, _preview_image, _preview_width, _preview_height, std::move(palette), settings, _color_picker->color());
+}
+
+void DitheringWindow::show_preview(int image_id, const std::vector<unsigned char>& image, int width, int height) {
+    if (image_id != _preview_image_id)
+        return;
+
+    _app->redraw();
+
+    using namespace nanogui;
+    if (_preview_texture.get() == nullptr || _preview_texture->size() != Vector2i(width, height)) {
+        _preview_texture = new Texture(Texture::PixelFormat::RGBA, Texture::ComponentFormat::UInt8, Vector2i(width, height),
+                                       Texture::InterpolationMode::Nearest, Texture::InterpolationMode::Nearest);
+    }
+    _preview_texture->upload(image.data());
+    _preview_view->set_image(_preview_texture);
+
+    Vector2i view_size = _preview_view->fixed_size();
+    _preview_view->set_scale(std::min((float)view_size[0] / width, (float)view_size[1] / height));
+    _preview_view->center();
+
+    if (!_preview_view->visible()) {
+        _preview_view->set_visible(true);
+        _app->perform_layout();
+    }
 }
\ No newline at end of file
@@ -1,23 +1,39 @@
 #pragma once
 #include <nanogui/nanogui.h>
+#include <thread>
+#include <memory>
+#include "image_source.hpp"
 
 class XStitchEditorApplication;
-
-enum DitheringAlgorithms {
-    FLOYD_STEINBURG,
-    BAYER,
-    QUANTISE
-};
+class Project;
+class Thread;
+class DitheringPreview;
+struct DitheringJob;
+struct DitheringSettings;
 
 class DitheringWindow : public nanogui::Window {
 public:
-    DitheringWindow(nanogui::Widget *parent) : _app((XStitchEditorApplication*)parent), nanogui::Window(parent, "") {};
+    DitheringWindow(nanogui::Widget *parent);
+    ~DitheringWindow();
     void initialise();
     void reset_form();
     void select_image();
+    virtual void draw(NVGcontext *ctx) override;
 
 private:
     void create_pattern();
+    std::vector<Thread*> selected_palette();
+    DitheringSettings selected_settings();
+    // Runs on the job thread, resizes the image and dithers it into project
+    void run_job(DitheringJob *job, const DitheringSettings& settings, int width, int height, ResizeFilters filter,
+                 std::vector<Thread*> *palette, Project *project);
+    // Runs on the UI thread once the job thread has finished
+    void finish_job(std::shared_ptr<DitheringJob> job, Project *project);
+    void cancel_job();
+    void show_progress(bool visible);
+    // Asks for a new preview with the current settings, call whenever one of them changes
+    void update_preview();
+    void show_preview(int image_id, const std::vector<unsigned char>& image, int width, int height);
 
     XStitchEditorApplication *_app;
 
@@ -26,18 +42,47 @@ private:
     nanogui::IntBox<int> *_width_intbox;
     nanogui::IntBox<int> *_height_intbox;
     nanogui::Button *_aspect_ratio_button;
+    nanogui::ComboBox *_resize_filter_combobox;
     nanogui::ColorPicker *_color_picker;
+    nanogui::ComboBox *_alpha_mode_combobox;
+    nanogui::Label *_alpha_cutoff_label;
+    nanogui::IntBox<int> *_alpha_cutoff_intbox;
     nanogui::ComboBox *_algorithm_combobox;
     nanogui::Label *_matrix_size_label;
     nanogui::Widget *_matrix_size_widget;
     nanogui::ComboBox *_matrix_size_combobox;
+    nanogui::Label *_serpentine_label;
+    nanogui::CheckBox *_serpentine_checkbox;
     std::vector<nanogui::CheckBox*> _palette_checkboxes;
     nanogui::CheckBox *_enable_thread_blending_checkbox;
     nanogui::CheckBox *_enable_max_threads_checkbox;
     nanogui::Label *_max_threads_label;
     nanogui::IntBox<int> *_max_threads_intbox;
+    nanogui::Button *_create_button;
+    nanogui::Widget *_progress_widget;
+    nanogui::Label *_progress_label;
+    nanogui::ProgressBar *_progress_bar;
+
+    // The image source belongs to the job thread while a job is running
+    std::shared_ptr<DitheringJob> _job;
+    std::thread _job_thread;
+
+    std::unique_ptr<DitheringPreview> _preview;
+    nanogui::ImageView *_preview_view;
+    nanogui::ref<nanogui::Texture> _preview_texture;
+    // A copy of the image small enough to quickly resize to each new preview size
+    std::vector<unsigned char> _preview_source;
+    int _preview_source_width = 0;
+    int _preview_source_height = 0;
+    // _preview_source resized to the project's aspect ratio, which is what actually gets dithered
+    std::vector<unsigned char> _preview_image;
+    int _preview_width = 0;
+    int _preview_height = 0;
+    ResizeFilters _preview_filter = ResizeFilters::AUTOMATIC;
+    int _preview_image_id = 0;
 
-    unsigned char *_image = nullptr;
+    // The selected image, read from again when the pattern is created
+    std::unique_ptr<ImageSource> _source;
     int _width = 0;
     int _height = 0;
 };
\ No newline at end of file
@@ -0,0 +1,352 @@
+#include "image_source.hpp"
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_FAILURE_USERMSG
+#include "stb_image.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize2.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <cmath>
+
+BufferImageSource::BufferImageSource(const unsigned char *pixels, int width, int height) : _pixels(pixels) {
+    _width = width;
+    _height = height;
+}
+
+void BufferImageSource::read_rows(int y, int count, unsigned char *rows) {
+    memcpy(rows, _pixels + ((size_t)y * _width * 4), (size_t)count * _width * 4);
+}
+
+StbImageSource::StbImageSource(const std::string& path) {
+    int no_channels;
+    _pixels = stbi_load(path.c_str(), &_width, &_height, &no_channels, 4); // requesting 4 channels
+    if (_pixels == nullptr)
+        throw std::runtime_error(stbi_failure_reason());
+}
+
+StbImageSource::~StbImageSource() {
+    stbi_image_free(_pixels);
+}
+
+void StbImageSource::read_rows(int y, int count, unsigned char *rows) {
+    memcpy(rows, _pixels + ((size_t)y * _width * 4), (size_t)count * _width * 4);
+}
+
+enum TiffTags {
+    IMAGE_WIDTH = 256,
+    IMAGE_LENGTH = 257,
+    BITS_PER_SAMPLE = 258,
+    COMPRESSION = 259,
+    PHOTOMETRIC_INTERPRETATION = 262,
+    STRIP_OFFSETS = 273,
+    SAMPLES_PER_PIXEL = 277,
+    ROWS_PER_STRIP = 278,
+    PLANAR_CONFIGURATION = 284,
+    TILE_WIDTH = 322,
+    EXTRA_SAMPLES = 338
+};
+
+// Reads the integers in a TIFF file, which can be stored either way round
+class TiffReader {
+public:
+    TiffReader(std::ifstream *file, bool big_endian) : _file(file), _big_endian(big_endian) {};
+
+    uint64_t read(int size) {
+        unsigned char bytes[4];
+        if (!_file->read((char*)bytes, size))
+            throw std::runtime_error("Error reading TIFF file: Unexpected end of file");
+
+        uint64_t value = 0;
+        for (int i = 0; i < size; i++)
+            value |= (uint64_t)bytes[_big_endian ? i : size - 1 - i] << (8 * (size - 1 - i));
+        return value;
+    }
+
+    // Values of a directory entry, which are either inline or at the offset that follows
+    std::vector<uint64_t> read_values(int type, uint32_t count) {
+        int size;
+        if (type == 1) // BYTE
+            size = 1;
+        else if (type == 3) // SHORT
+            size = 2;
+        else if (type == 4) // LONG
+            size = 4;
+        else
+            throw std::runtime_error(fmt::format("Error reading TIFF file: Unsupported field type {}", type));
+
+        std::streampos next_entry = _file->tellg() + (std::streamoff)4;
+        if ((uint64_t)size * count > 4)
+            _file->seekg(read(4));
+
+        std::vector<uint64_t> values;
+        for (uint32_t i = 0; i < count; i++)
+            values.push_back(read(size));
+        _file->seekg(next_entry);
+        return values;
+    }
+
+    // First value of a directory entry, for tags that only have one
+    uint64_t read_value(int type, uint32_t count) {
+        if (count == 0)
+            throw std::runtime_error("Error reading TIFF file: Field with no values");
+        return read_values(type, count)[0];
+    }
+
+private:
+    std::ifstream *_file;
+    bool _big_endian;
+};
+
+TiffImageSource::TiffImageSource(const std::string& path) : _file(path, std::ios::binary) {
+    if (!_file)
+        throw std::runtime_error(fmt::format("Failed to open {}", path));
+
+    char byte_order[2];
+    _file.read(byte_order, 2);
+    TiffReader reader(&_file, byte_order[0] == 'M');
+    if (reader.read(2) != 42)
+        throw std::runtime_error("Error reading TIFF file: BigTIFF and other variants are not supported");
+
+    _file.seekg(reader.read(4));
+    int no_entries = reader.read(2);
+
+    std::vector<uint64_t> bits_per_sample = {1};
+    int compression = 1;
+    int photometric_interpretation = -1;
+    int planar_configuration = 1;
+    int extra_samples = 0;
+    _samples_per_pixel = 1;
+    _rows_per_strip = INT_MAX;
+    bool tiled = false;
+
+    for (int i = 0; i < no_entries; i++) {
+        int tag = reader.read(2);
+        int type = reader.read(2);
+        uint32_t count = reader.read(4);
+
+        switch (tag) {
+            case TiffTags::IMAGE_WIDTH: _width = reader.read_value(type, count); break;
+            case TiffTags::IMAGE_LENGTH: _height = reader.read_value(type, count); break;
+            case TiffTags::BITS_PER_SAMPLE: bits_per_sample = reader.read_values(type, count); break;
+            case TiffTags::COMPRESSION: compression = reader.read_value(type, count); break;
+            case TiffTags::PHOTOMETRIC_INTERPRETATION: photometric_interpretation = reader.read_value(type, count); break;
+            case TiffTags::STRIP_OFFSETS: _strip_offsets = reader.read_values(type, count); break;
+            case TiffTags::SAMPLES_PER_PIXEL: _samples_per_pixel = reader.read_value(type, count); break;
+            case TiffTags::ROWS_PER_STRIP: _rows_per_strip = std::min<uint64_t>(INT_MAX, reader.read_value(type, count)); break;
+            case TiffTags::PLANAR_CONFIGURATION: planar_configuration = reader.read_value(type, count); break;
+            case TiffTags::TILE_WIDTH: tiled = true; reader.read(4); break;
+            case TiffTags::EXTRA_SAMPLES: extra_samples = reader.read_value(type, count); break;
+            default: reader.read(4); break;
+        }
+    }
+
+    if (compression != 1)
+        throw std::runtime_error("Error reading TIFF file: Only uncompressed images are supported");
+    if (tiled || planar_configuration != 1)
+        throw std::runtime_error("Error reading TIFF file: Only images stored in strips are supported");
+    for (uint64_t bits : bits_per_sample) {
+        if (bits != 8)
+            throw std::runtime_error("Error reading TIFF file: Only 8 bit images are supported");
+    }
+
+    int colour_samples;
+    if (photometric_interpretation == 0 || photometric_interpretation == 1) {
+        colour_samples = 1;
+        _greyscale = true;
+        _white_is_zero = photometric_interpretation == 0;
+    } else if (photometric_interpretation == 2) {
+        colour_samples = 3;
+    } else {
+        throw std::runtime_error("Error reading TIFF file: Only greyscale and RGB images are supported");
+    }
+
+    if (_width <= 0 || _height <= 0 || _samples_per_pixel < colour_samples || _strip_offsets.empty())
+        throw std::runtime_error("Error reading TIFF file: Missing image dimensions or data");
+
+    // Other extra samples (e.g. masks) are ignored
+    _has_alpha = _samples_per_pixel > colour_samples && (extra_samples == 1 || extra_samples == 2);
+    _associated_alpha = extra_samples == 1;
+    if (_rows_per_strip <= 0)
+        throw std::runtime_error("Error reading TIFF file: No rows per strip");
+    _rows_per_strip = std::min(_rows_per_strip, _height);
+    int no_strips = (_height + _rows_per_strip - 1) / _rows_per_strip;
+    if (_strip_offsets.size() < no_strips)
+        throw std::runtime_error("Error reading TIFF file: Missing strips");
+
+    // Every strip must be in the file, rather than finding out part way through reading it
+    _file.seekg(0, std::ios::end);
+    uint64_t file_size = _file.tellg();
+    uint64_t row_bytes = (uint64_t)_width * _samples_per_pixel;
+    for (int strip = 0; strip < no_strips; strip++) {
+        uint64_t strip_rows = std::min(_rows_per_strip, _height - (strip * _rows_per_strip));
+        if (_strip_offsets[strip] > file_size || strip_rows * row_bytes > file_size - _strip_offsets[strip])
+            throw std::runtime_error("Error reading TIFF file: Strip outside of the file");
+    }
+}
+
+void TiffImageSource::read_rows(int y, int count, unsigned char *rows) {
+    size_t row_bytes = (size_t)_width * _samples_per_pixel;
+    std::vector<unsigned char> samples;
+
+    int end = y + count;
+    while (y < end) {
+        // Rows within a strip follow on from each other, so read as many as possible at once
+        int strip = y / _rows_per_strip;
+        int no_rows = std::min(end, (strip + 1) * _rows_per_strip) - y;
+        samples.resize(no_rows * row_bytes);
+        {
+            // Only the file is shared, converting the samples can happen in parallel
+            std::lock_guard<std::mutex> lock(_mutex);
+            _file.seekg(_strip_offsets[strip] + ((uint64_t)(y - (strip * _rows_per_strip)) * row_bytes));
+            if (!_file.read((char*)samples.data(), samples.size())) {
+                _file.clear();
+                throw std::runtime_error("Error reading TIFF file: Unexpected end of file");
+            }
+        }
+
+        for (size_t i = 0; i < (size_t)no_rows * _width; i++) {
+            const unsigned char *sample = &samples[i * _samples_per_pixel];
+            unsigned char *pixel = &rows[i * 4];
+            if (_greyscale) {
+                unsigned char grey = _white_is_zero ? 255 - sample[0] : sample[0];
+                pixel[0] = grey;
+                pixel[1] = grey;
+                pixel[2] = grey;
+                pixel[3] = _has_alpha ? sample[1] : 255;
+            } else {
+                pixel[0] = sample[0];
+                pixel[1] = sample[1];
+                pixel[2] = sample[2];
+                pixel[3] = _has_alpha ? sample[3] : 255;
+            }
+
+            if (_associated_alpha) {
+                for (int c = 0; c < 3; c++)
+                    pixel[c] = pixel[3] == 0 ? 0 : std::min(255, (pixel[c] * 255) / pixel[3]);
+            }
+        }
+
+        rows += (size_t)no_rows * _width * 4;
+        y += no_rows;
+    }
+}
+
+std::unique_ptr<ImageSource> open_image(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[4] = {};
+    file.read(magic, 4);
+    file.close();
+
+    if (memcmp(magic, "II*\0", 4) == 0 || memcmp(magic, "MM\0*", 4) == 0)
+        return std::make_unique<TiffImageSource>(path);
+    return std::make_unique<StbImageSource>(path);
+}
+
+// Gives stb_image_resize the source rows it asks for, keeping the strip they came from
+struct StripReader {
+    ImageSource *source;
+    std::vector<unsigned char> rows;
+    int first_row = 0;
+    int no_rows = 0;
+    // stb_image_resize is C, so errors are kept until it returns rather than thrown through it
+    std::exception_ptr error;
+};
+
+// All the splits of a resize share its callback context, so each thread points this at its own
+// reader
+static thread_local StripReader *strip_reader = nullptr;
+
+static const void* read_source_row(void *optional_output, const void *input_ptr, int num_pixels, int x, int y, void *context) {
+    StripReader *reader = strip_reader;
+    if (y < reader->first_row || y >= reader->first_row + reader->no_rows) {
+        // Rows are asked for in order, other than the filter sometimes reaching back a few rows
+        reader->first_row = y < reader->first_row ? std::max(0, y - STRIP_ROWS + 1) : y;
+        reader->no_rows = std::min(STRIP_ROWS, reader->source->height() - reader->first_row);
+        try {
+            reader->source->read_rows(reader->first_row, reader->no_rows, reader->rows.data());
+        } catch (...) {
+            if (!reader->error)
+                reader->error = std::current_exception();
+            std::fill(reader->rows.begin(), reader->rows.end(), 0);
+        }
+    }
+
+    return &reader->rows[(((size_t)(y - reader->first_row) * reader->source->width()) + x) * 4];
+}
+
+// Lanczos with 3 lobes, which stb_image_resize doesn't have built in
+static float lanczos_kernel(float x, float scale, void *user_data) {
+    x = fabsf(x);
+    if (x < 1e-6f)
+        return 1.f;
+    if (x >= 3.f)
+        return 0.f;
+
+    float pi_x = (float)M_PI * x;
+    return 3.f * sinf(pi_x) * sinf(pi_x / 3.f) / (pi_x * pi_x);
+}
+
+static float lanczos_support(float scale, void *user_data) {
+    return 3.f;
+}
+
+void resize_image(ImageSource *source, unsigned char *output, int width, int height, ResizeFilters filter) {
+    int source_width = source->width();
+    int source_height = source->height();
+
+    // Nothing to resize, just copy the rows across a strip at a time
+    if (width == source_width && height == source_height) {
+        for (int y = 0; y < height; y += STRIP_ROWS)
+            source->read_rows(y, std::min(STRIP_ROWS, height - y), output + ((size_t)y * width * 4));
+        return;
+    }
+
+    STBIR_RESIZE resize;
+    // The source rows all come through the input callback, so there are no input pixels
+    stbir_resize_init(&resize, nullptr, source_width, source_height, 0, output, width, height, 0,
+                      stbir_pixel_layout::STBIR_RGBA, stbir_datatype::STBIR_TYPE_UINT8_SRGB);
+    stbir_set_pixel_callbacks(&resize, read_source_row, nullptr);
+    if (filter == ResizeFilters::BOX) {
+        stbir_set_filters(&resize, stbir_filter::STBIR_FILTER_BOX, stbir_filter::STBIR_FILTER_BOX);
+    } else if (filter == ResizeFilters::MITCHELL) {
+        stbir_set_filters(&resize, stbir_filter::STBIR_FILTER_MITCHELL, stbir_filter::STBIR_FILTER_MITCHELL);
+    } else if (filter == ResizeFilters::LANCZOS) {
+        stbir_set_filter_callbacks(&resize, lanczos_kernel, lanczos_support, lanczos_kernel, lanczos_support);
+    }
+
+    // stb_image_resize picks how many splits are worth it, each split is a band of the output
+    int splits = stbir_build_samplers_with_splits(&resize, std::max(1U, std::thread::hardware_concurrency()));
+    if (splits == 0)
+        throw std::runtime_error("Error resizing image");
+
+    std::vector<StripReader> readers(splits);
+    std::vector<int> results(splits);
+    auto run_split = [&](int split) {
+        StripReader& reader = readers[split];
+        reader.source = source;
+        reader.rows.resize((size_t)source_width * STRIP_ROWS * 4);
+        strip_reader = &reader;
+        results[split] = stbir_resize_extended_split(&resize, split, 1);
+        strip_reader = nullptr;
+    };
+
+    std::vector<std::thread> threads;
+    for (int split = 1; split < splits; split++)
+        threads.push_back(std::thread(run_split, split));
+    run_split(0);
+    for (std::thread& thread : threads)
+        thread.join();
+    stbir_free_samplers(&resize);
+
+    for (int split = 0; split < splits; split++) {
+        if (readers[split].error)
+            std::rethrow_exception(readers[split].error);
+        if (!results[split])
+            throw std::runtime_error("Error resizing image");
+    }
+}
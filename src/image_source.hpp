@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+
+// Number of source rows read at a time while resizing
+#define STRIP_ROWS 64
+
+// An image that can be read a few rows at a time, so that a large image doesn't have to be held
+// in memory in full. Rows are always read as RGBA.
+class ImageSource {
+public:
+    virtual ~ImageSource() {};
+
+    int width() const { return _width; };
+    int height() const { return _height; };
+
+    // Reads count rows starting at row y into rows, which must have room for width * count * 4
+    // bytes. Rows can be read in any order, though reading them top to bottom is the fastest.
+    // Safe to call from more than one thread at once.
+    virtual void read_rows(int y, int count, unsigned char *rows) = 0;
+
+protected:
+    int _width = 0;
+    int _height = 0;
+};
+
+// An image that is already in memory, the pixels must outlive the source
+class BufferImageSource : public ImageSource {
+public:
+    BufferImageSource(const unsigned char *pixels, int width, int height);
+
+    void read_rows(int y, int count, unsigned char *rows) override;
+
+private:
+    const unsigned char *_pixels;
+};
+
+// PNG and JPEG images, decoded in full with stb_image since it can't decode part of an image
+class StbImageSource : public ImageSource {
+public:
+    StbImageSource(const std::string& path);
+    ~StbImageSource();
+
+    void read_rows(int y, int count, unsigned char *rows) override;
+
+private:
+    unsigned char *_pixels = nullptr;
+};
+
+// Uncompressed baseline TIFF images (the usual output of scanners), 8 bit greyscale or RGB with
+// an optional alpha channel. Only the rows asked for are read from the file.
+class TiffImageSource : public ImageSource {
+public:
+    TiffImageSource(const std::string& path);
+
+    void read_rows(int y, int count, unsigned char *rows) override;
+
+private:
+    std::ifstream _file;
+    std::mutex _mutex;
+    std::vector<uint64_t> _strip_offsets;
+    int _rows_per_strip = 0;
+    int _samples_per_pixel = 0;
+    bool _greyscale = false;
+    bool _white_is_zero = false;
+    bool _has_alpha = false;
+    // The alpha channel is premultiplied into the colour channels
+    bool _associated_alpha = false;
+};
+
+// Opens the image at path with whichever source handles its format. Throws std::runtime_error
+// if the image can't be read.
+std::unique_ptr<ImageSource> open_image(const std::string& path);
+
+enum ResizeFilters {
+    // Mitchell when shrinking and Catmull-Rom when enlarging
+    AUTOMATIC,
+    // Averages the pixels covered, the softest of the filters
+    BOX,
+    MITCHELL,
+    // Three lobed Lanczos, the sharpest of the filters
+    LANCZOS
+};
+
+// Resizes the whole of source to width x height RGBA pixels in output, split across as many
+// threads as there are cores. Each thread only holds STRIP_ROWS rows of the source at a time.
+void resize_image(ImageSource *source, unsigned char *output, int width, int height, ResizeFilters filter = ResizeFilters::AUTOMATIC);
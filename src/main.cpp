@@ -12,23 +12,6 @@
 #  include <windows.h>
 #endif
 
-#if defined(MACOSX_BUNDLE)
-
-std::string get_resources_dir() {
-    CFURLRef resourceURL = CFBundleCopyResourcesDirectoryURL(CFBundleGetMainBundle());
-    char resourcePath[PATH_MAX];
-    if (CFURLGetFileSystemRepresentation(resourceURL, true, (UInt8*)resourcePath, PATH_MAX)) {
-        if (resourceURL != NULL)
-            CFRelease(resourceURL);
-        return resourcePath;
-    }
-    return "";
-}
-#else
-
-std::string get_resources_dir() { return "/Users/george/Documents/uni_year_three/Digital Systems Project/X-Stitch-Editor/assets"; };
-#endif
-
 int main(int, char **) {
     try {
         nanogui::init();
@@ -37,7 +20,9 @@ int main(int, char **) {
             nanogui::ref<XStitchEditorApplication> app = new XStitchEditorApplication();
             app->draw_all();
             app->set_visible(true);
-            nanogui::mainloop(1 / 60.f * 1000);
+            app->redraw();
+            // Frames are only drawn after an event or a call to redraw()
+            nanogui::mainloop(-1.f);
         }
 
         nanogui::shutdown();
@@ -168,7 +168,7 @@ bool MainMenuWindow::save() {
         bool saved = save_as();
         return saved;
     } else {
-        _app->_project->save(_app->_project->file_path.c_str(), _app);
+        _app->_project->save(_app->_project->file_path.c_str());
         close_all_menus();
         return true;
     }
@@ -177,7 +177,7 @@ bool MainMenuWindow::save() {
 bool MainMenuWindow::save_as() {
     std::string path = nanogui::file_dialog(permitted_files, true);
     if (path != "") {
-        _app->_project->save(path.c_str(), _app);
+        _app->_project->save(path.c_str());
         close_all_menus();
         return true;
     }
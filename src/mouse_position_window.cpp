@@ -15,13 +15,18 @@ void MousePositionWindow::initialise() {
 void MousePositionWindow::set_captions(int stitch_x, int stitch_y, Thread *thread) {
     int screen_height = _app->framebuffer_size()[1] / _app->pixel_ratio();
 
-    _mouse_location_label->set_caption(fmt::format("stitch selected: {}, {}", stitch_x, stitch_y));
-    if (thread != nullptr) {
-        _mouse_location_label_2->set_caption(fmt::format("thread: {}", thread->full_name(thread->default_position())));
-        set_position(Vector2i(0, screen_height - 42));
-    } else {
-        _mouse_location_label_2->set_caption("");
-        set_position(Vector2i(0, screen_height - 26));
-    }
+    std::string caption = fmt::format("stitch selected: {}, {}", stitch_x, stitch_y);
+    std::string caption_2 = thread != nullptr ? fmt::format("thread: {}", thread->full_name(thread->default_position())) : "";
+    set_position(Vector2i(0, screen_height - (thread != nullptr ? 42 : 26)));
     set_visible(true);
+
+    if (caption == _mouse_location_label->caption() && caption_2 == _mouse_location_label_2->caption())
+        return;
+
+    // Only this window's size depends on the captions, so the rest of the screen is left alone
+    _mouse_location_label->set_caption(caption);
+    _mouse_location_label_2->set_caption(caption_2);
+    NVGcontext *ctx = _app->nvg_context();
+    set_size(preferred_size(ctx));
+    perform_layout(ctx);
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "paths.hpp"
+#include <filesystem>
+#include <cstdlib>
+#include <climits>
+
+#if defined(__APPLE__)
+#include "CoreFoundation/CoreFoundation.h"
+#endif
+
+static std::string resources_dir_override;
+
+void set_resources_dir(const std::string& path) {
+    resources_dir_override = path;
+}
+
+#if defined(__APPLE__) && defined(MACOSX_BUNDLE)
+
+std::string get_resources_dir() {
+    if (!resources_dir_override.empty())
+        return resources_dir_override;
+
+    CFURLRef resourceURL = CFBundleCopyResourcesDirectoryURL(CFBundleGetMainBundle());
+    char resourcePath[PATH_MAX];
+    if (CFURLGetFileSystemRepresentation(resourceURL, true, (UInt8*)resourcePath, PATH_MAX)) {
+        if (resourceURL != NULL)
+            CFRelease(resourceURL);
+        return resourcePath;
+    }
+    return "";
+}
+#else
+
+std::string get_resources_dir() {
+    if (!resources_dir_override.empty())
+        return resources_dir_override;
+
+    return "/Users/george/Documents/uni_year_three/Digital Systems Project/X-Stitch-Editor/assets";
+};
+#endif
+
+std::string get_cache_dir() {
+    std::filesystem::path dir;
+#if defined(__APPLE__)
+    if (const char *home = std::getenv("HOME"))
+        dir = std::filesystem::path(home) / "Library" / "Caches";
+#elif defined(_WIN32)
+    if (const char *local_app_data = std::getenv("LOCALAPPDATA"))
+        dir = local_app_data;
+#else
+    const char *xdg_cache = std::getenv("XDG_CACHE_HOME");
+    if (xdg_cache && *xdg_cache)
+        dir = xdg_cache;
+    else if (const char *home = std::getenv("HOME"))
+        dir = std::filesystem::path(home) / ".cache";
+#endif
+    if (dir.empty())
+        dir = std::filesystem::temp_directory_path();
+
+    dir /= "X-Stitch-Editor";
+    std::error_code err;
+    std::filesystem::create_directories(dir, err);
+    return dir.string();
+}
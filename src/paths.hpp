@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+
+// Directory holding the fonts, symbols and thread palettes, or "" if it can't be found
+std::string get_resources_dir();
+// Overrides the directory returned by get_resources_dir, for when it isn't run from the app bundle
+void set_resources_dir(const std::string& path);
+// Per user directory for files that can be regenerated, created if it doesn't exist
+std::string get_cache_dir();
@@ -1,13 +1,13 @@
 #include <iostream>
 #include <map>
-#include <nanogui/nanogui.h>
+#include <nanogui/vector.h>
 #include <freetype/ftstroke.h>
 #include "pdf_creation.hpp"
 #include "threads.hpp"
 #include <fmt/core.h>
 #include <ctime>
 #include <limits>
-#include "constants.hpp"
+#include "paths.hpp"
 
 using nanogui::Vector2f;
 
@@ -676,8 +676,8 @@ void PDFWizard::fetch_symbol_data() {
             continue;
 
         _symbol_key_rows.push_back(new TableRow{
-            i, t->full_name(t->default_position()),
-            t->description(t->default_position()), t->is_blended()
+            i, std::string(t->full_name(t->default_position())),
+            std::string(t->description(t->default_position())), t->is_blended()
         });
     }
 
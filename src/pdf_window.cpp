@@ -84,12 +84,14 @@ void PDFWindow::save_pdf() {
     if (_author_textbox->value() == "") {
         _errors->set_caption("Author cannot be empty!");
         _errors->set_visible(true);
+        _app->perform_layout();
         return;
     }
 
     if (_author_textbox->value().size() > 50) {
         _errors->set_caption("Author cannot be longer than 50 characters!");
         _errors->set_visible(true);
+        _app->perform_layout();
         return;
     }
 
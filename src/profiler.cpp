@@ -0,0 +1,99 @@
+#include "profiler.hpp"
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <fmt/core.h>
+
+namespace {
+
+int64_t steady_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t current_thread_number() {
+    static std::atomic<uint32_t> next_thread{0};
+    thread_local uint32_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+    return thread;
+}
+
+std::string escape_json(const char *text) {
+    std::string escaped;
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\')
+            escaped += '\\';
+        escaped += *text;
+    }
+    return escaped;
+}
+
+}
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() : _slots(new Slot[PROFILER_CAPACITY]), _epoch(steady_nanoseconds()) {}
+
+int64_t Profiler::now() const {
+    return steady_nanoseconds() - _epoch;
+}
+
+void Profiler::record(const char *name, int64_t start, int64_t duration) {
+    uint64_t n = _next.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _slots[n % PROFILER_CAPACITY];
+
+    // Readers that see the odd sequence, or a different one after copying, drop what they read
+    slot.sequence.store((2 * n) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.thread.store(current_thread_number(), std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.sequence.store((2 * n) + 2, std::memory_order_release);
+}
+
+std::vector<ProfileSample> Profiler::samples() const {
+    uint64_t end = _next.load(std::memory_order_acquire);
+    uint64_t begin = end > PROFILER_CAPACITY ? end - PROFILER_CAPACITY : 0;
+
+    std::vector<ProfileSample> samples;
+    samples.reserve(end - begin);
+    for (uint64_t n = begin; n < end; n++) {
+        const Slot& slot = _slots[n % PROFILER_CAPACITY];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != (2 * n) + 2)
+            continue;
+
+        ProfileSample sample{
+            slot.name.load(std::memory_order_relaxed),
+            slot.thread.load(std::memory_order_relaxed),
+            slot.start.load(std::memory_order_relaxed),
+            slot.duration.load(std::memory_order_relaxed)
+        };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+            samples.push_back(sample);
+    }
+    return samples;
+}
+
+void Profiler::write_chrome_trace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file)
+        throw std::runtime_error(fmt::format("Failed to open {}", path));
+
+    // Complete ("X") events, timed in microseconds
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    for (const ProfileSample& sample : samples()) {
+        file << fmt::format("{}\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+            first ? "" : ",", escape_json(sample.name), sample.thread, sample.start / 1000.0, sample.duration / 1000.0);
+        first = false;
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    if (!file)
+        throw std::runtime_error(fmt::format("Failed to write {}", path));
+}
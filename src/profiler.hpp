@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Number of timings kept, once it is full the oldest are overwritten
+#define PROFILER_CAPACITY 16384
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// Times the rest of the enclosing scope under name, which must be a string literal
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(_profile_timer_, __LINE__)(name)
+
+struct ProfileSample {
+    const char *name;
+    // Small number identifying the thread it was recorded on, the first thread to record is 0
+    uint32_t thread;
+    // Nanoseconds since the profiler was created
+    int64_t start;
+    int64_t duration;
+};
+
+/* Records how long named sections of code take, from any thread, in a fixed size ring buffer.
+Recording claims a slot with a single atomic add and never waits on a lock, so timers can be left
+in hot paths. While the profiler is disabled a timer costs one relaxed load. */
+class Profiler {
+public:
+    static Profiler& instance();
+
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); };
+    void set_enabled(bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); };
+    // Nanoseconds since the profiler was created
+    int64_t now() const;
+    void record(const char *name, int64_t start, int64_t duration);
+
+    // Every sample still in the buffer, oldest first. Samples being written while it reads are left out.
+    std::vector<ProfileSample> samples() const;
+    // Saves the samples in Chrome's trace event format, for chrome://tracing or Perfetto. Throws
+    // runtime_error if path can't be written.
+    void write_chrome_trace(const std::string& path) const;
+
+private:
+    Profiler();
+
+    struct Slot {
+        // 2n + 1 while the nth sample is being written to it, 2n + 2 once it has been
+        std::atomic<uint64_t> sequence{0};
+        // Each field is atomic so a reader copying a slot while it is overwritten reads torn values
+        // it then throws away, rather than racing
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint32_t> thread{0};
+        std::atomic<int64_t> start{0};
+        std::atomic<int64_t> duration{0};
+    };
+
+    std::atomic<bool> _enabled{false};
+    std::atomic<uint64_t> _next{0};
+    std::unique_ptr<Slot[]> _slots;
+    int64_t _epoch;
+};
+
+// Records the time between being created and destroyed, if the profiler was enabled when it was created
+class ScopedTimer {
+public:
+    ScopedTimer(const char *name) : _name(name) {
+        Profiler& profiler = Profiler::instance();
+        _start = profiler.enabled() ? profiler.now() : -1;
+    };
+    ~ScopedTimer() {
+        if (_start >= 0) {
+            Profiler& profiler = Profiler::instance();
+            profiler.record(_name, _start, profiler.now() - _start);
+        }
+    };
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char *_name;
+    int64_t _start;
+};
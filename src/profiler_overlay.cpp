@@ -0,0 +1,78 @@
+#include <nanogui/opengl.h>
+#include <algorithm>
+#include <map>
+#include <fmt/core.h>
+
+#include "profiler_overlay.hpp"
+#include "profiler.hpp"
+
+// Samples older than this aren't counted, in nanoseconds
+#define OVERLAY_WINDOW 1000000000
+// How often the numbers are worked out again, in nanoseconds
+#define OVERLAY_UPDATE_INTERVAL 500000000
+// Most sections listed, the ones taking the least time are left off
+#define OVERLAY_MAX_ROWS 16
+#define OVERLAY_WIDTH 330
+#define OVERLAY_LINE_HEIGHT 16
+
+using namespace nanogui;
+
+void ProfilerOverlay::update_rows(int64_t now) {
+    std::map<std::string, Row> rows;
+    _frames = Row{"frame"};
+    for (const ProfileSample& sample : Profiler::instance().samples()) {
+        if (sample.start + sample.duration < now - OVERLAY_WINDOW)
+            continue;
+
+        Row& row = (sample.name == _frames.name) ? _frames : rows[sample.name];
+        double ms = sample.duration / 1e6;
+        row.calls++;
+        row.total_ms += ms;
+        row.max_ms = std::max(row.max_ms, ms);
+    }
+
+    _rows.clear();
+    for (auto& [name, row] : rows) {
+        row.name = name;
+        _rows.push_back(row);
+    }
+    std::sort(_rows.begin(), _rows.end(), [](const Row& a, const Row& b) { return a.total_ms > b.total_ms; });
+    if (_rows.size() > OVERLAY_MAX_ROWS)
+        _rows.resize(OVERLAY_MAX_ROWS);
+
+    _last_update = now;
+}
+
+void ProfilerOverlay::draw(NVGcontext *ctx, int screen_width) {
+    int64_t now = Profiler::instance().now();
+    if (_last_update < 0 || now - _last_update >= OVERLAY_UPDATE_INTERVAL)
+        update_rows(now);
+
+    std::vector<std::string> lines;
+    if (_frames.calls > 0) {
+        lines.push_back(fmt::format("{} frames  avg {:.2f}ms  max {:.2f}ms",
+            _frames.calls, _frames.total_ms / _frames.calls, _frames.max_ms));
+    } else {
+        lines.push_back("No frames drawn in the last second");
+    }
+    for (const Row& row : _rows) {
+        lines.push_back(fmt::format("{:<26} {:>4}x {:>7.2f}ms {:>7.2f}ms",
+            row.name, row.calls, row.total_ms / row.calls, row.max_ms));
+    }
+
+    float x = screen_width - OVERLAY_WIDTH - 10;
+    float y = 10;
+    nvgSave(ctx);
+    nvgBeginPath(ctx);
+    nvgRoundedRect(ctx, x, y, OVERLAY_WIDTH, (lines.size() * OVERLAY_LINE_HEIGHT) + 10, 3);
+    nvgFillColor(ctx, Color(0, 180));
+    nvgFill(ctx);
+
+    nvgFontFace(ctx, "mono");
+    nvgFontSize(ctx, 13);
+    nvgTextAlign(ctx, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+    nvgFillColor(ctx, Color(255, 230));
+    for (size_t i = 0; i < lines.size(); i++)
+        nvgText(ctx, x + 6, y + 5 + (i * OVERLAY_LINE_HEIGHT), lines[i].c_str(), nullptr);
+    nvgRestore(ctx);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <nanogui/nanogui.h>
+
+/* Frame time and the time spent in each profiled section over the last second, drawn over the
+top right of the screen. The numbers are only worked out again a few times a second so that they
+can be read. */
+class ProfilerOverlay {
+public:
+    void draw(NVGcontext *ctx, int screen_width);
+
+private:
+    struct Row {
+        std::string name;
+        int calls = 0;
+        double total_ms = 0;
+        double max_ms = 0;
+    };
+
+    void update_rows(int64_t now);
+
+    // Every profiled section apart from frames, most time spent first
+    std::vector<Row> _rows;
+    Row _frames;
+    int64_t _last_update = -1;
+};
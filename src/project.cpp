@@ -1,6 +1,7 @@
 #include "project.hpp"
 #include "threads.hpp"
-#include "x_stitch_editor.hpp"
+#include "catalogue.hpp"
+#include "profiler.hpp"
 #include <fmt/core.h>
 #include <iostream>
 #include <queue>
@@ -88,7 +89,8 @@ Project::Project(std::string title_, int width_, int height_, nanogui::Color bg_
     }
 }
 
-Project::Project(const char *project_path, std::map<std::string, std::map<std::string, Thread*>*> *threads) {
+Project::Project(const char *project_path, CatalogueDirectory *catalogues) {
+    PROFILE_SCOPE("load project");
     using namespace tinyxml2;
 
     file_path = project_path;
@@ -124,6 +126,14 @@ Project::Project(const char *project_path, std::map<std::string, std::map<std::s
     std::string cloth_color_str = retrieve_string_attribute(cloth, "color");
     bg_color = hex2rgb(cloth_color_str);
 
+    // Throws std::out_of_range like std::map::at if the thread isn't in any catalogue
+    auto find_thread = [catalogues](const std::string& manufacturer, const std::string& number) {
+        SingleThread *thread = catalogues->find(manufacturer, number);
+        if (thread == nullptr)
+            throw std::out_of_range(manufacturer + " " + number);
+        return thread;
+    };
+
     std::regex thread_regex = std::regex("([a-zA-Z0-9]+) +([a-zA-Z0-9]+)");
     bool match = true;
     for (int i = 0; i < palette_length; i++) {
@@ -150,17 +160,12 @@ Project::Project(const char *project_path, std::map<std::string, std::map<std::s
                 if (!match)
                     throw std::runtime_error("Error parsing file, blended palette number in unrecognised format");
 
-                auto manufacturer_1 = threads->at(matches.str(1));
-                auto manufacturer_2 = threads->at(matches_2.str(1));
+                SingleThread *t1 = find_thread(matches.str(1), matches.str(2));
+                SingleThread *t2 = find_thread(matches_2.str(1), matches_2.str(2));
 
-                SingleThread *t1 = (SingleThread*)manufacturer_1->at(matches.str(2));
-                SingleThread *t2 = (SingleThread*)manufacturer_2->at(matches_2.str(2));
-
-                BlendedThread *blended_thread = new BlendedThread(create_blended_thread(t1, t2));
-                palette.push_back(blended_thread);
+                palette.push_back(get_blended_thread(t1, t2));
             } else {
-                auto manufacturer = threads->at(matches.str(1));
-                palette.push_back(manufacturer->at(matches.str(2)));
+                palette.push_back(find_thread(matches.str(1), matches.str(2)));
             }
         } catch (std::out_of_range&) {
             throw std::runtime_error(fmt::format("Error parsing file, unrecognised thread referenced: {} {}", matches.str(1), matches.str(2)));
@@ -237,16 +242,6 @@ Project::Project(const char *project_path, std::map<std::string, std::map<std::s
     }
 };
 
-Project::~Project() {
-    // Any blended threads need to be deleted
-    for (Thread *t : palette) {
-        if (t == nullptr || !t->is_blended())
-            continue;
-
-        delete (BlendedThread*)t;
-    }
-}
-
 void Project::draw_stitch(Vector2i stitch, Thread *thread) {
     int palette_index = -1;
     for (int i = 0; i < palette.size(); i++) {
@@ -283,6 +278,7 @@ void Project::erase_stitch(Vector2i stitch) {
 }
 
 void Project::fill_from_stitch(Vector2i stitch, Thread *thread) {
+    PROFILE_SCOPE("fill");
     Thread *target_thread = find_thread_at_stitch(stitch);
 
     if (target_thread == thread)
@@ -322,6 +318,7 @@ void Project::fill_from_stitch(Vector2i stitch, Thread *thread) {
 }
 
 void Project::draw_backstitch(Vector2f start_stitch, Vector2f end_stitch, Thread *thread) {
+    PROFILE_SCOPE("draw backstitch");
     // Check if stitch is in range
     if (!is_backstitch_valid(start_stitch) || !(is_backstitch_valid(end_stitch)))
         return;
@@ -387,6 +384,7 @@ Vector2f* get_intersection(Vector2f p0, Vector2f p1, Vector2f p2, Vector2f p3) {
 }
 
 void Project::erase_backstitches_intersecting(Vector2i stitch) {
+    PROFILE_SCOPE("erase backstitches");
     std::vector<int> to_delete;
 
     Vector2f substitches[9] = {
@@ -530,7 +528,8 @@ Thread* Project::find_thread_at_stitch(Vector2i stitch) {
     }
 }
 
-void Project::save(const char *filepath, XStitchEditorApplication *app) {
+void Project::save(const char *filepath) {
+    PROFILE_SCOPE("save project");
     using namespace tinyxml2;
 
     XMLDocument doc(false);
@@ -618,12 +617,12 @@ void Project::save(const char *filepath, XStitchEditorApplication *app) {
         Thread *t = normalised_palette[i];
         palette_item_element = palette_element->InsertNewChildElement("palette_item");
         palette_item_element->SetAttribute("index", i + 1);
-        palette_item_element->SetAttribute("number", t->full_name(ThreadPosition::FIRST).c_str());
-        palette_item_element->SetAttribute("name", t->description(t->default_position()).c_str());
+        palette_item_element->SetAttribute("number", std::string(t->full_name(ThreadPosition::FIRST)).c_str());
+        palette_item_element->SetAttribute("name", std::string(t->description(t->default_position())).c_str());
         if (t->is_blended()) {
             BlendedThread *bt = (BlendedThread*)t;
 
-            palette_item_element->SetAttribute("blendnumber", bt->full_name(ThreadPosition::SECOND).c_str());
+            palette_item_element->SetAttribute("blendnumber", std::string(bt->full_name(ThreadPosition::SECOND)).c_str());
             palette_item_element->SetAttribute("color", fmt::format(
                 "{:02x}{:02x}{:02x}", bt->thread_1->R, bt->thread_1->G, bt->thread_1->B).c_str());
             palette_item_element->SetAttribute("blendcolor", fmt::format(
@@ -677,6 +676,7 @@ bool Project::is_backstitch_valid(Vector2f stitch) {
 }
 
 void Project::remove_from_palette(Thread *thread) {
+    PROFILE_SCOPE("remove from palette");
     int to_delete = -1;
     for (int i = 0; i < palette.size(); i++) {
         if (palette[i] == thread) {
@@ -714,9 +714,6 @@ void Project::remove_from_palette(Thread *thread) {
 
     backstitches = new_backstitches;
 
-    // Remove thread from palette, and delete it if it's blended
-    // TODO: probably create blended threads using shared_ptr and let *that* handle deletion
+    // Blended threads are shared with other projects, so aren't deleted
     palette[to_delete] = nullptr;
-    if (thread->is_blended())
-        delete (BlendedThread*)thread;
 }
\ No newline at end of file
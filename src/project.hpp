@@ -4,7 +4,8 @@
 #include <regex>
 #include <map>
 #include <vector>
-#include <nanogui/nanogui.h>
+#include <memory>
+#include <nanogui/vector.h>
 #include <tinyxml2.h>
 
 std::string retrieve_string_attribute(tinyxml2::XMLElement *element, const char *key);
@@ -22,7 +23,7 @@ nanogui::Vector2f* get_intersection(nanogui::Vector2f p0, nanogui::Vector2f p1,
 
 class Thread;
 class BlendedThread;
-class XStitchEditorApplication;
+class CatalogueDirectory;
 
 struct BackStitch {
     nanogui::Vector2f start;
@@ -49,9 +50,8 @@ public:
 
     // construct an empty project (throws std::invalid_argument if title, width or height are invalid)
     Project(std::string title_, int width_, int height_, nanogui::Color bg_color_);
-    // construct a project using a .OXS file.
-    Project(const char *project_path, std::map<std::string, std::map<std::string, Thread*>*> *threads);
-    ~Project();
+    // construct a project using a .OXS file, with threads from the catalogues.
+    Project(const char *project_path, CatalogueDirectory *catalogues);
     // Draws a single stitch to the canvas. Throws std::runtime_error if the thread provided is not in the project palette.
     void draw_stitch(nanogui::Vector2i stitch, Thread *thread);
     // Draws a single stitch to the canvas. Doesn't check if the thread provided is in the project palette.
@@ -70,7 +70,7 @@ public:
     // Returns the thread at the stitch provided (or nullptr if there are none).
     Thread* find_thread_at_stitch(nanogui::Vector2i stitch);
     // Attempts to save the project to the file provided.
-    void save(const char *filepath, XStitchEditorApplication *app);
+    void save(const char *filepath);
     // Tests if a stitch is within the range for the canvas.
     bool is_stitch_valid(nanogui::Vector2i stitch);
     // Tests if a backstitch stitch is within the range for the canvas.
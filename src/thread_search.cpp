@@ -0,0 +1,201 @@
+#include "thread_search.hpp"
+#include "catalogue.hpp"
+#include <algorithm>
+#include <numeric>
+#include <charconv>
+#include <cctype>
+
+// A word with a typo still matches if it shares at least this fraction of its trigrams
+#define FUZZY_MIN_TRIGRAM_FRACTION 0.5
+
+// Score of each kind of match, lowest first. Fuzzy matches score worse the more trigrams they miss.
+enum MatchScore {
+    EXACT_NUMBER = 0,
+    WORD_PREFIX = 10,
+    SUBSTRING = 20,
+    FUZZY = 30
+};
+
+namespace {
+
+std::string to_lower(std::string_view text) {
+    std::string lower(text);
+    for (char& c : lower)
+        c = std::tolower((unsigned char)c);
+    return lower;
+}
+
+std::vector<std::string> split_words(const std::string& text) {
+    std::vector<std::string> words;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(' ', start);
+        if (end == std::string::npos)
+            end = text.size();
+        if (end > start)
+            words.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return words;
+}
+
+// Calls f with every trigram of word, packed into an integer
+template <typename F>
+void for_each_trigram(const std::string& word, F f) {
+    for (size_t i = 0; i + 3 <= word.size(); i++)
+        f(((uint32_t)(unsigned char)word[i] << 16) | ((uint32_t)(unsigned char)word[i+1] << 8) | (uint32_t)(unsigned char)word[i+2]);
+}
+
+// Reads a colour written as #RRGGBB
+bool parse_colour(std::string_view query, int *R, int *G, int *B) {
+    while (!query.empty() && query.front() == ' ')
+        query.remove_prefix(1);
+    while (!query.empty() && query.back() == ' ')
+        query.remove_suffix(1);
+    if (query.size() != 7 || query[0] != '#')
+        return false;
+
+    int *channels[3] = {R, G, B};
+    for (int i = 0; i < 3; i++) {
+        const char *begin = query.data() + 1 + (i * 2);
+        auto [end, err] = std::from_chars(begin, begin + 2, *channels[i], 16);
+        if (err != std::errc() || end != begin + 2)
+            return false;
+    }
+    return true;
+}
+
+}
+
+void ThreadSearchIndex::add(ThreadCatalogue *catalogue) {
+    _catalogues.push_back(catalogue);
+    for (SingleThread& thread : catalogue->threads()) {
+        uint32_t index = _entries.size();
+        Entry entry{&thread, to_lower(thread.number()), to_lower(fmt::format("{} {}", thread.number(), thread.description()))};
+
+        for (std::string& word : split_words(entry.text)) {
+            for_each_trigram(word, [this, index](uint32_t trigram) {
+                std::vector<uint32_t>& entries = _trigrams[trigram];
+                if (entries.empty() || entries.back() != index)
+                    entries.push_back(index);
+            });
+            _words.emplace_back(std::move(word), index);
+        }
+
+        _entries.push_back(std::move(entry));
+    }
+
+    std::sort(_words.begin(), _words.end());
+}
+
+std::vector<SingleThread*> ThreadSearchIndex::search(std::string_view query) const {
+    int R, G, B;
+    if (parse_colour(query, &R, &G, &B))
+        return nearest(rgb_to_oklab(R, G, B), COLOUR_SEARCH_RESULTS);
+
+    std::vector<SingleThread*> results;
+    std::vector<std::string> words = split_words(to_lower(query));
+    if (words.empty()) {
+        results.reserve(_entries.size());
+        for (const Entry& entry : _entries)
+            results.push_back(entry.thread);
+        return results;
+    }
+
+    // Total score of each entry over the words so far, -1 once a word doesn't match it
+    std::vector<int> scores(_entries.size(), 0);
+    std::vector<int> word_scores(_entries.size());
+    std::vector<int> trigram_hits(_entries.size());
+    std::vector<uint32_t> candidates;
+    for (const std::string& word : words) {
+        std::fill(word_scores.begin(), word_scores.end(), -1);
+        std::fill(trigram_hits.begin(), trigram_hits.end(), 0);
+        candidates.clear();
+
+        // Only entries with a word starting with this one, or sharing a trigram with it, can match
+        auto prefixed = std::lower_bound(_words.begin(), _words.end(), std::make_pair(word, (uint32_t)0));
+        for (; prefixed != _words.end() && prefixed->first.compare(0, word.size(), word) == 0; prefixed++)
+            candidates.push_back(prefixed->second);
+
+        int trigram_count = 0;
+        for_each_trigram(word, [&](uint32_t trigram) {
+            trigram_count++;
+            auto entries = _trigrams.find(trigram);
+            if (entries == _trigrams.end())
+                return;
+            for (uint32_t entry : entries->second) {
+                if (trigram_hits[entry]++ == 0)
+                    candidates.push_back(entry);
+            }
+        });
+
+        for (uint32_t entry : candidates) {
+            if (scores[entry] != -1 && word_scores[entry] == -1)
+                word_scores[entry] = score_word(entry, word, trigram_hits, trigram_count);
+        }
+
+        for (size_t i = 0; i < scores.size(); i++)
+            scores[i] = (scores[i] == -1 || word_scores[i] == -1) ? -1 : scores[i] + word_scores[i];
+    }
+
+    std::vector<uint32_t> matches;
+    for (uint32_t i = 0; i < scores.size(); i++) {
+        if (scores[i] != -1)
+            matches.push_back(i);
+    }
+    std::stable_sort(matches.begin(), matches.end(), [&scores](uint32_t a, uint32_t b) { return scores[a] < scores[b]; });
+
+    results.reserve(matches.size());
+    for (uint32_t i : matches)
+        results.push_back(_entries[i].thread);
+    return results;
+}
+
+int ThreadSearchIndex::score_word(uint32_t entry, const std::string& word, const std::vector<int>& trigram_hits, int trigram_count) const {
+    const Entry& e = _entries[entry];
+    if (e.number == word)
+        return MatchScore::EXACT_NUMBER;
+
+    size_t position = e.text.find(word);
+    if (position != std::string::npos) {
+        for (; position != std::string::npos; position = e.text.find(word, position + 1)) {
+            if (position == 0 || e.text[position - 1] == ' ')
+                return MatchScore::WORD_PREFIX;
+        }
+        return MatchScore::SUBSTRING;
+    }
+
+    // A single trigram either matches exactly or not at all
+    int hits = std::min(trigram_hits[entry], trigram_count);
+    if (trigram_count >= 2 && hits >= trigram_count * FUZZY_MIN_TRIGRAM_FRACTION)
+        return MatchScore::FUZZY + (trigram_count - hits);
+
+    return -1;
+}
+
+std::vector<SingleThread*> ThreadSearchIndex::nearest(Lab colour, size_t count) const {
+    // Reads the catalogues' own arrays of colours rather than going through each thread
+    std::vector<float> distances;
+    distances.reserve(_entries.size());
+    for (const ThreadCatalogue *catalogue : _catalogues) {
+        for (const Lab& lab : catalogue->labs()) {
+            float dL = lab.L - colour.L;
+            float da = lab.a - colour.a;
+            float db = lab.b - colour.b;
+            distances.push_back((dL * dL) + (da * da) + (db * db));
+        }
+    }
+
+    std::vector<uint32_t> order(distances.size());
+    std::iota(order.begin(), order.end(), 0);
+    count = std::min(count, order.size());
+    std::partial_sort(order.begin(), order.begin() + count, order.end(), [&distances](uint32_t a, uint32_t b) {
+        return distances[a] < distances[b] || (distances[a] == distances[b] && a < b);
+    });
+
+    std::vector<SingleThread*> results;
+    results.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        results.push_back(_entries[order[i]].thread);
+    return results;
+}
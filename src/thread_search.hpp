@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "threads.hpp"
+
+class ThreadCatalogue;
+
+// How many of the nearest threads a colour search returns
+#define COLOUR_SEARCH_RESULTS 50
+
+/* Finds threads by number, description or colour across any number of catalogues, quickly enough
+to search again on every key press. Words are indexed by prefix and text by trigram, so a query
+only looks at the threads that could match it. A word with a typo in it still matches as long as
+most of its trigrams do. */
+class ThreadSearchIndex {
+public:
+    // Indexes every thread in catalogue, which must outlive the index
+    void add(ThreadCatalogue *catalogue);
+    size_t size() const { return _entries.size(); };
+
+    /* Threads matching every word of query, best matches first: an exact thread number, then words
+    starting with the query, then text containing it, then fuzzy matches. Words shorter than three
+    letters only match the start of a word. An empty query returns every thread in the order they
+    were added. A colour written as #RRGGBB returns the threads nearest to it instead. */
+    std::vector<SingleThread*> search(std::string_view query) const;
+    // The count threads nearest to colour (in Oklab), nearest first
+    std::vector<SingleThread*> nearest(Lab colour, size_t count) const;
+
+private:
+    struct Entry {
+        SingleThread *thread;
+        // Lower case, for matching against
+        std::string number;
+        std::string text;
+    };
+
+    // Lower score is a better match, or -1 if entry doesn't match word
+    int score_word(uint32_t entry, const std::string& word, const std::vector<int>& trigram_hits, int trigram_count) const;
+
+    std::vector<Entry> _entries;
+    // In the order they were added, so each one's threads are the next block of entries
+    std::vector<ThreadCatalogue*> _catalogues;
+    // Each word of every entry, sorted so that the words with a prefix are next to each other
+    std::vector<std::pair<std::string, uint32_t>> _words;
+    // The entries each trigram appears in, in ascending order with no repeats
+    std::unordered_map<uint32_t, std::vector<uint32_t>> _trigrams;
+};
@@ -1,17 +1,33 @@
 #include "threads.hpp"
-#include "x_stitch_editor.hpp"
 
 #include <sstream>
 #include <string>
 #include <map>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <cmath>
 #include <fmt/core.h>
 
 #include <tinyxml2.h>
 #include <fmt/core.h>
 
-bool is_duplicate(BlendedThread *t1, BlendedThread *t2) {
-    return (t1->thread_1 == t2->thread_1 && t1->thread_2 == t2->thread_2) ||
-           (t1->thread_1 == t2->thread_2 && t1->thread_2 == t2->thread_1);
+// from: https://bottosson.github.io/posts/oklab/
+Lab rgb_to_oklab(int R, int G, int B) {
+    float l = 0.4122214708f * R + 0.5363325363f * G + 0.0514459929f * B;
+    float m = 0.2119034982f * R + 0.6806995451f * G + 0.1073969566f * B;
+    float s = 0.0883024619f * R + 0.2817188376f * G + 0.6299787005f * B;
+
+    float l_ = cbrtf(l);
+    float m_ = cbrtf(m);
+    float s_ = cbrtf(s);
+
+    return {
+        0.2104542553f*l_ + 0.7936177850f*m_ - 0.0040720468f*s_,
+        1.9779984951f*l_ - 2.4285922050f*m_ + 0.4505937099f*s_,
+        0.0259040371f*l_ + 0.7827717662f*m_ - 0.8086757660f*s_,
+    };
 }
 
 // A simple average will give incorrect results, per: https://stackoverflow.com/a/29576746
@@ -22,7 +38,39 @@ BlendedThread create_blended_thread(SingleThread *thread_1, SingleThread *thread
     return BlendedThread(thread_1, thread_2, sqrt(R), sqrt(G), sqrt(B));
 }
 
-std::string load_manufacturer(const char *file_path, std::map<std::string, Thread*> *map) {
+namespace {
+
+struct SingleThreadPairHash {
+    size_t operator()(const std::pair<SingleThread*, SingleThread*>& pair) const {
+        size_t hash = std::hash<SingleThread*>()(pair.first);
+        return hash ^ (std::hash<SingleThread*>()(pair.second) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    }
+};
+
+// A deque allocates its elements in blocks and never moves them, so it doubles as the pool
+std::mutex blend_registry_mutex;
+std::deque<BlendedThread> blend_pool;
+// Keyed by the two threads in address order, so a pair asked for either way round finds the same blend
+std::unordered_map<std::pair<SingleThread*, SingleThread*>, BlendedThread*, SingleThreadPairHash> blend_registry;
+
+}
+
+BlendedThread* get_blended_thread(SingleThread *thread_1, SingleThread *thread_2) {
+    auto key = std::less<SingleThread*>()(thread_1, thread_2) ? std::make_pair(thread_1, thread_2) : std::make_pair(thread_2, thread_1);
+    std::lock_guard<std::mutex> lock(blend_registry_mutex);
+    auto [entry, added] = blend_registry.try_emplace(key, nullptr);
+    // The blend shows its threads in the order they were first asked for
+    if (added)
+        entry->second = &blend_pool.emplace_back(create_blended_thread(thread_1, thread_2));
+    return entry->second;
+}
+
+size_t blended_thread_count() {
+    std::lock_guard<std::mutex> lock(blend_registry_mutex);
+    return blend_pool.size();
+}
+
+std::string load_manufacturer(const char *file_path, std::vector<ParsedThread> *threads) {
     tinyxml2::XMLDocument doc;
     if (doc.LoadFile(file_path) != tinyxml2::XML_SUCCESS)
         throw std::runtime_error(fmt::format("Failed to open {}", file_path));
@@ -57,9 +105,7 @@ std::string load_manufacturer(const char *file_path, std::map<std::string, Threa
         if (element->QueryIntAttribute("blue", &thread_b) != tinyxml2::XML_SUCCESS)
             throw std::runtime_error("Error parsing XML file: Thread element containing no blue value");
 
-        Thread *thread_struct = new SingleThread(manufacturer_name, thread_number, thread_description, thread_r, thread_g, thread_b);
-
-        (*map)[thread_number] = thread_struct;
+        threads->push_back(ParsedThread{thread_number, thread_description, thread_r, thread_g, thread_b});
 
         element = element->NextSiblingElement("thread");
         if (element == nullptr)
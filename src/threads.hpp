@@ -1,10 +1,17 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <vector>
 #include <map>
-#include <nanogui/nanogui.h>
+#include <nanogui/vector.h>
 #include <fmt/core.h>
 #include <iostream>
 
+// A colour in the Oklab colour space, worked out from 0..255 RGB values
+struct Lab {float L; float a; float b;};
+
+Lab rgb_to_oklab(int R, int G, int B);
+
 enum ThreadPosition {
     FIRST,
     SECOND,
@@ -16,58 +23,68 @@ public:
     int R;
     int G;
     int B;
+    Lab lab;
 
-    Thread(int R, int G, int B) : R(R), G(G), B(B) {};
+    Thread(int R, int G, int B) : R(R), G(G), B(B), lab(rgb_to_oklab(R, G, B)) {};
+    // For when the Oklab colour is already known, e.g. from a compiled catalogue
+    Thread(int R, int G, int B, Lab lab) : R(R), G(G), B(B), lab(lab) {};
+    virtual ~Thread() = default;
 
     nanogui::Color color() {
         return nanogui::Color(nanogui::Vector3i(R, G, B));
     };
 
-    virtual std::string company(ThreadPosition position = ThreadPosition::FIRST) = 0;
-    virtual std::string number(ThreadPosition position = ThreadPosition::FIRST) = 0;
-    virtual std::string description(ThreadPosition position = ThreadPosition::FIRST) = 0;
-    virtual std::string full_name(ThreadPosition position = ThreadPosition::FIRST) = 0;
+    // Names are formatted once when the thread is created, so these don't allocate. The views last
+    // as long as the thread does.
+    virtual std::string_view company(ThreadPosition position = ThreadPosition::FIRST) const = 0;
+    virtual std::string_view number(ThreadPosition position = ThreadPosition::FIRST) const = 0;
+    virtual std::string_view description(ThreadPosition position = ThreadPosition::FIRST) const = 0;
+    virtual std::string_view full_name(ThreadPosition position = ThreadPosition::FIRST) const = 0;
     virtual bool is_blended() = 0;
     ThreadPosition default_position() {
         return is_blended() ? ThreadPosition::BOTH : ThreadPosition::FIRST;
     }
 };
 
+/* A thread from a manufacturer's catalogue. Its strings aren't copied, they are views into the
+string table of the ThreadCatalogue that holds it, which stores each string once. */
 class SingleThread : public Thread {
 public:
-    SingleThread(std::string company, std::string number,
-        std::string description, int R, int G, int B) :
+    // full_name is the company and number separated by a space
+    SingleThread(std::string_view company, std::string_view number, std::string_view description,
+        std::string_view full_name, int R, int G, int B, Lab lab) :
         _company(company), _number(number), _description(description),
-        Thread(R, G, B) {};
+        _full_name(full_name), Thread(R, G, B, lab) {};
 
-    virtual std::string company(ThreadPosition position) {
+    virtual std::string_view company(ThreadPosition position = ThreadPosition::FIRST) const {
         check_position(position);
         return _company;
     }
 
-    virtual std::string number(ThreadPosition position) {
+    virtual std::string_view number(ThreadPosition position = ThreadPosition::FIRST) const {
         check_position(position);
         return _number;
     }
 
-    virtual std::string description(ThreadPosition position) {
+    virtual std::string_view description(ThreadPosition position = ThreadPosition::FIRST) const {
         check_position(position);
         return _description;
     }
 
-    virtual std::string full_name(ThreadPosition position) {
+    virtual std::string_view full_name(ThreadPosition position = ThreadPosition::FIRST) const {
         check_position(position);
-        return _company + " " + _number;
+        return _full_name;
     }
 
     virtual bool is_blended() { return false; };
 
 private:
-    std::string _company;
-    std::string _number;
-    std::string _description;
+    std::string_view _company;
+    std::string_view _number;
+    std::string_view _description;
+    std::string_view _full_name;
 
-    void check_position(ThreadPosition position) {
+    void check_position(ThreadPosition position) const {
         if (position == ThreadPosition::SECOND)
             throw std::invalid_argument("SingleThread does not have a second thread");
     }
@@ -81,9 +98,11 @@ public:
     SingleThread* thread_2;
 
     BlendedThread(SingleThread *thread_1, SingleThread *thread_2,
-        int R, int G, int B) : thread_1(thread_1), thread_2(thread_2), Thread(R, G, B) {};
+        int R, int G, int B) : thread_1(thread_1), thread_2(thread_2), Thread(R, G, B),
+        _description(fmt::format("{} mixed with {}", thread_1->_description, thread_2->_description)),
+        _full_name(fmt::format("{} / {}", thread_1->_full_name, thread_2->_full_name)) {};
 
-    virtual std::string company(ThreadPosition position) {
+    virtual std::string_view company(ThreadPosition position = ThreadPosition::FIRST) const {
         switch (position) {
             case ThreadPosition::FIRST: return thread_1->_company;
             case ThreadPosition::SECOND: return thread_2->_company;
@@ -92,7 +111,7 @@ public:
         }
     }
 
-    virtual std::string number(ThreadPosition position) {
+    virtual std::string_view number(ThreadPosition position = ThreadPosition::FIRST) const {
         switch (position) {
             case ThreadPosition::FIRST: return thread_1->_number;
             case ThreadPosition::SECOND: return thread_2->_number;
@@ -101,31 +120,50 @@ public:
         }
     }
 
-    virtual std::string description(ThreadPosition position) {
+    virtual std::string_view description(ThreadPosition position = ThreadPosition::FIRST) const {
         switch (position) {
             case ThreadPosition::FIRST: return thread_1->_description;
             case ThreadPosition::SECOND: return thread_2->_description;
-            case ThreadPosition::BOTH:
-                return fmt::format("{} mixed with {}", thread_1->_description, thread_2->_description);
+            case ThreadPosition::BOTH: return _description;
         }
     }
 
-    virtual std::string full_name(ThreadPosition position) {
+    virtual std::string_view full_name(ThreadPosition position = ThreadPosition::FIRST) const {
         switch (position) {
-            case ThreadPosition::FIRST: return thread_1->full_name(ThreadPosition::FIRST);
-            case ThreadPosition::SECOND: return thread_2->full_name(ThreadPosition::FIRST);
-            case ThreadPosition::BOTH:
-                return fmt::format("{} / {}", thread_1->full_name(ThreadPosition::FIRST), thread_2->full_name(ThreadPosition::FIRST));
+            case ThreadPosition::FIRST: return thread_1->_full_name;
+            case ThreadPosition::SECOND: return thread_2->_full_name;
+            case ThreadPosition::BOTH: return _full_name;
         }
     }
 
     virtual bool is_blended() { return true; };
-};
 
-bool is_duplicate(BlendedThread *t1, BlendedThread *t2);
+private:
+    std::string _description;
+    std::string _full_name;
+};
 
 BlendedThread create_blended_thread(SingleThread *thread_1, SingleThread *thread_2);
 
-class XStitchEditorApplication;
+/* The blend of thread_1 with thread_2. Each pair is only ever blended once, whichever way round it
+is given, and every caller gets that same BlendedThread (named in the order the pair was first
+given), which lives for as long as the application does, so blends must never be
+deleted. Only blend threads that also live that long, such as catalogue threads. Safe to call
+from several threads at once. */
+BlendedThread* get_blended_thread(SingleThread *thread_1, SingleThread *thread_2);
+
+// How many different blends get_blended_thread has made
+size_t blended_thread_count();
+
+// A thread as it is written in a manufacturer's XML catalogue
+struct ParsedThread {
+    std::string number;
+    std::string description;
+    int R;
+    int G;
+    int B;
+};
 
-std::string load_manufacturer(const char *file_path, std::map<std::string, Thread*> *map);
\ No newline at end of file
+// Reads the threads of the XML catalogue at file_path into threads, in the order they are written,
+// and returns the manufacturer's name. Throws std::runtime_error if the file can't be parsed.
+std::string load_manufacturer(const char *file_path, std::vector<ParsedThread> *threads);
\ No newline at end of file
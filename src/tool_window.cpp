@@ -8,6 +8,8 @@
 #include "canvas_renderer.hpp"
 #include "constants.hpp"
 #include "camera2d.hpp"
+#include "catalogue.hpp"
+#include "virtual_grid.hpp"
 
 #define MAKE_TOOLBUTTON_CALLBACK(tool, cursor) [&] {                        \
         _app->_selected_tool = tool;                                        \
@@ -15,9 +17,20 @@
         _app->_previous_backstitch_point = NO_SUBSTITCH_SELECTED;           \
     }                                                                       \
 
+#define THREAD_GRID_COLUMNS 7
+#define THREAD_GRID_HEIGHT 500
+#define PALETTE_ROW_HEIGHT 30
+#define PALETTE_LIST_HEIGHT 370
+#define REMOVE_THREAD_NAME_WIDTH 200
+#define REMOVE_THREAD_LIST_HEIGHT 400
+
 using namespace nanogui;
 using Anchor = AdvancedGridLayout::Anchor;
 
+const Vector2i THREAD_GRID_CELL_SIZE = Vector2i(44, 50);
+const Vector2i THREAD_SWATCH_SIZE = Vector2i(32, 25);
+const Vector2i REMOVE_THREAD_ROW_SIZE = Vector2i(REMOVE_THREAD_NAME_WIDTH + (THREAD_SWATCH_SIZE[0] * 2) + 100, 30);
+
 void PaletteButton::palettebutton_callback() {
     _app->_selected_thread = _thread;
     _app->tool_window->update_selected_thread_widget();
@@ -39,16 +52,12 @@ void AddToPaletteButton::palettebutton_callback() {
 
     _button->set_background_color(_thread->color());
     _button->set_pushed(false);
-    _button->set_caption(_thread->full_name(_thread->default_position()));
-    _app->tool_window->create_themes();
-    if ((_thread->R * 0.2126f) + (_thread->G * 0.7152f) + (_thread->B * 0.0722f) > 179) {
-        _button->set_theme(_app->tool_window->_palettebutton_black_text_theme);
-    } else {
-        _button->set_theme(_app->tool_window->_palettebutton_white_text_theme);
-    }
+    _button->set_caption(std::string(_thread->full_name(_thread->default_position())));
+    _button->set_theme(_app->tool_window->thread_text_theme(_thread));
 
     _app->tool_window->_clear_threads_button->set_enabled(true);
     _app->tool_window->_add_thread_button->set_enabled(true);
+    _app->perform_layout();
 };
 
 void DeletePaletteButton::palettebutton_callback() {
@@ -164,6 +173,20 @@ void ToolWindow::initialise() {
     _add_to_palette_widget = new Widget(_add_to_palette_button->popup());
     _add_to_palette_widget->set_layout(new GroupLayout(10, 5, 10, 0));
     _add_to_palette_button->popup()->set_fixed_height(122);
+    // The thread lists need every catalogue loaded, so they aren't built until they are first needed
+    _add_to_palette_button->set_callback([this]() {
+        if (_thread_lists_built)
+            return;
+        for (const std::string& manufacturer : _app->_catalogues->names()) {
+            ThreadCatalogue *catalogue = _app->_catalogues->catalogue(manufacturer);
+            if (catalogue != nullptr)
+                _thread_search.add(catalogue);
+        }
+        create_thread_search_popup(_add_thread_popup_button);
+        create_thread_search_popup(_add_blend_thread_popup_button);
+        _thread_lists_built = true;
+        _app->perform_layout();
+    });
 
     _add_thread_popup_button = new PopupButton(_add_to_palette_widget, "Select Thread");
     _add_thread_popup_button->set_chevron_icon(0);
@@ -181,7 +204,7 @@ void ToolWindow::initialise() {
     _add_thread_button->set_callback([this]() {
         Thread *t = nullptr;
         if (_selected_thread != nullptr && _selected_blend_thread != nullptr) {
-            t = new BlendedThread(create_blended_thread(_selected_thread, _selected_blend_thread));
+            t = get_blended_thread(_selected_thread, _selected_blend_thread);
         } else if (_selected_thread != nullptr) {
             t = _selected_thread;
         }
@@ -189,21 +212,9 @@ void ToolWindow::initialise() {
         if (t == nullptr)
             return;
 
+        // Every blend of the same two threads is the same BlendedThread
         for (Thread *pt : _app->_project->palette) {
-            if (pt == nullptr)
-                continue;
-            bool thread_exists = false;
-            if (t->is_blended() && pt->is_blended()) {
-                BlendedThread *t1 = (BlendedThread*)t;
-                BlendedThread *t2 = (BlendedThread*)pt;
-
-                if (is_duplicate(t1, t2))
-                    thread_exists = true;
-            } else if (t == pt) {
-                thread_exists = true;
-            }
-
-            if (thread_exists) {
+            if (pt == t) {
                 new MessageDialog(_app, MessageDialog::Type::Warning, "Error", "The thread selected is already in this project's palette.");
                 return;
             }
@@ -230,13 +241,71 @@ void ToolWindow::initialise() {
     _remove_from_palette_button->set_chevron_icon(0);
     _remove_from_palette_button->set_enabled(false);
     _remove_from_palette_button->set_callback([this]() { update_remove_thread_widget(); });
-    _remove_threads_scroll_panel = new VScrollPanel(_remove_from_palette_button->popup());
-    _remove_from_palette_widget = new Widget(_remove_threads_scroll_panel);
-    _remove_from_palette_widget->set_layout(new GroupLayout(10, 5, 10, 0));
+    Popup *remove_popup = _remove_from_palette_button->popup();
+    remove_popup->set_layout(new GroupLayout(10, 5, 10, 0));
+
+    auto create_remove_row = [this](Widget *list) {
+        Widget *row = new Widget(list);
+        row->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Middle, 0, 5));
+        new Label(row, "");
+        row->child_at(0)->set_fixed_width(REMOVE_THREAD_NAME_WIDTH);
+
+        // Room for both colours of a blend, so the delete buttons line up
+        Widget *colour_widget = new Widget(row);
+        colour_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Middle, 0, 5));
+        colour_widget->set_fixed_width((THREAD_SWATCH_SIZE[0] * 2) + 5);
+        new DisabledButton(colour_widget, "");
+        new DisabledButton(colour_widget, "");
+        colour_widget->child_at(0)->set_fixed_size(THREAD_SWATCH_SIZE);
+        colour_widget->child_at(1)->set_fixed_size(THREAD_SWATCH_SIZE);
+
+        DeletePaletteButton *delete_button = new DeletePaletteButton(row, "Delete");
+        delete_button->set_app(_app);
+        delete_button->set_callback();
+        return row;
+    };
+    auto bind_remove_row = [this](Widget *row, int index) {
+        Thread *t = _palette_threads[index];
+        ((Label*)row->child_at(0))->set_caption(std::string(t->full_name(t->default_position())));
+
+        Button *colour_button = (Button*)row->child_at(1)->child_at(0);
+        Button *colour_button_2 = (Button*)row->child_at(1)->child_at(1);
+        if (t->is_blended()) {
+            BlendedThread *bt = (BlendedThread*)t;
+            colour_button->set_background_color(bt->thread_1->color());
+            colour_button_2->set_background_color(bt->thread_2->color());
+        } else {
+            colour_button->set_background_color(t->color());
+        }
+        colour_button_2->set_visible(t->is_blended());
+
+        ((DeletePaletteButton*)row->child_at(2))->set_thread(t);
+    };
+
+    _remove_threads_list = new VirtualList(remove_popup, REMOVE_THREAD_ROW_SIZE, 5, REMOVE_THREAD_LIST_HEIGHT,
+                                           create_remove_row, bind_remove_row);
 
-    update_thread_list_popups(_add_thread_popup_button);
-    update_thread_list_popups(_add_blend_thread_popup_button);
     create_themes();
+
+    // Palette
+    auto create_palette_row = [this](Widget *list) {
+        PaletteButton *button = new PaletteButton(list);
+        button->set_app(_app);
+        button->set_callback();
+        return button;
+    };
+    auto bind_palette_row = [this](Widget *row, int index) {
+        Thread *t = _palette_threads[index];
+        PaletteButton *button = (PaletteButton*)row;
+        button->set_thread(t);
+        button->set_background_color(t->color());
+        button->set_tooltip(std::string(t->description(t->default_position())));
+        button->set_caption(std::string(t->full_name(t->default_position())));
+        button->set_theme(thread_text_theme(t));
+    };
+
+    _palette_list = new VirtualList(this, Vector2i(0, PALETTE_ROW_HEIGHT), 5, PALETTE_LIST_HEIGHT, create_palette_row, bind_palette_row);
+    _palette_list->set_visible(false);
 };
 
 void ToolWindow::reset_add_thread_form() {
@@ -254,156 +323,91 @@ void ToolWindow::reset_add_thread_form() {
     _add_blend_thread_popup_button->set_enabled(false);
     _clear_threads_button->set_enabled(false);
     _add_thread_button->set_enabled(false);
+    _app->perform_layout();
 }
 
-void ToolWindow::update_thread_list_popups(PopupButton *add_thread_btn) {
-    while (add_thread_btn->child_count() > 0) {
-        add_thread_btn->remove_child_at(0);
-    }
-
-    VScrollPanel *scroll = new VScrollPanel(add_thread_btn->popup());
-    Widget *popup = new Widget(scroll);
-    popup->set_layout(new BoxLayout(Orientation::Vertical, Alignment::Middle, 5, 5));
-    popup->set_fixed_height(500);
-
-    for (const auto & [manufacturer, man_threads] : _app->_threads) {
-        Label *popup_label = new Label(popup, manufacturer, "sans-bold");
-        Widget *man_widget = new Widget(popup);
-        man_widget->set_layout(new GridLayout(Orientation::Horizontal, 7, Alignment::Maximum, 0, 5));
-
-        for (const auto & [key, thread] : *man_threads) {
-            Widget *thread_widget = new Widget(man_widget);
-            thread_widget->set_layout(new BoxLayout(Orientation::Vertical, Alignment::Middle, 2, 5));
-            AddToPaletteButton *popup_thread = new AddToPaletteButton(thread_widget);
-            popup_thread->set_thread(thread);
-            popup_thread->set_app(_app);
-            popup_thread->set_popup_button(add_thread_btn);
-            popup_thread->set_callback();
-            popup_thread->set_background_color(thread->color());
-            popup_thread->set_tooltip(thread->description());
-            popup_label = new Label(thread_widget, thread->number());
+void ToolWindow::create_thread_search_popup(PopupButton *add_thread_btn) {
+    Popup *popup = add_thread_btn->popup();
+    popup->set_layout(new BoxLayout(Orientation::Vertical, Alignment::Fill, 10, 5));
+
+    SearchBox *search_box = new SearchBox(popup);
+    search_box->set_placeholder("Number, name or #RRGGBB");
+    Label *no_results_label = new Label(popup, "No threads found");
+    no_results_label->set_visible(false);
+
+    // Shared with the grid's callbacks, which outlive this function
+    auto results = std::make_shared<std::vector<SingleThread*>>(_thread_search.search(""));
+
+    auto create_cell = [this, add_thread_btn](Widget *grid) {
+        Widget *cell = new Widget(grid);
+        cell->set_layout(new BoxLayout(Orientation::Vertical, Alignment::Middle, 0, 5));
+        AddToPaletteButton *button = new AddToPaletteButton(cell);
+        button->set_fixed_size(THREAD_SWATCH_SIZE);
+        button->set_app(_app);
+        button->set_popup_button(add_thread_btn);
+        button->set_callback();
+        new Label(cell, "");
+        return cell;
+    };
+    auto bind_cell = [results](Widget *cell, int index) {
+        SingleThread *thread = (*results)[index];
+        AddToPaletteButton *button = (AddToPaletteButton*)cell->child_at(0);
+        button->set_thread(thread);
+        button->set_background_color(thread->color());
+        button->set_tooltip(fmt::format("{}: {}", thread->full_name(), thread->description()));
+        ((Label*)cell->child_at(1))->set_caption(std::string(thread->number()));
+    };
+
+    VirtualGrid *grid = new VirtualGrid(popup, THREAD_GRID_COLUMNS, THREAD_GRID_CELL_SIZE, 5, THREAD_GRID_HEIGHT, create_cell, bind_cell);
+    grid->set_fixed_height(THREAD_GRID_HEIGHT);
+    grid->set_item_count(results->size());
+
+    search_box->set_edit_callback([this, results, grid, no_results_label](const std::string& query) {
+        *results = _thread_search.search(query);
+        grid->set_item_count(results->size());
+        if (no_results_label->visible() != results->empty()) {
+            no_results_label->set_visible(results->empty());
+            _app->perform_layout();
         }
-    }
+    });
 }
 
 void ToolWindow::update_remove_thread_widget() {
-    if (_remove_threads_widget != nullptr) {
-        _remove_from_palette_widget->remove_child(_remove_threads_widget);
-        _remove_threads_widget = nullptr;
-    }
-
-    int palette_entries = 0;
-    for (Thread *t : _app->_project->palette)
-        if (t != nullptr)
-            palette_entries++;
-
-    if (palette_entries == 0) {
-        _app->perform_layout();
-        return;
-    }
-
-    _remove_threads_widget = new Widget(_remove_from_palette_widget);
-    GridLayout *layout = new GridLayout(Orientation::Horizontal, 3, Alignment::Middle, 0, 5);
-    // layout->set_col_alignment(Alignment::Fill);
-    // layout->set_row_alignment(Alignment::Middle);
-    _remove_threads_widget->set_layout(layout);
-
-    // at two rows the spacing is calculated wrong and cuts into the widgets
-    // manually set the height so this can't happen
-    if (palette_entries == 2) {
-        _remove_threads_widget->set_fixed_height(70);
-    }
-
-    for (Thread *t : _app->_project->palette) {
-        if (t == nullptr)
-            continue;
-
-        new Label(_remove_threads_widget, t->full_name(t->default_position()));
-
-        if (t->is_blended()) {
-            BlendedThread *bt = (BlendedThread*)t;
-            Widget *colour_widget = new Widget(_remove_threads_widget);
-            colour_widget->set_layout(new BoxLayout(Orientation::Horizontal, Alignment::Middle, 0, 5));
-            DisabledButton *colour_button = new DisabledButton(colour_widget, "  ");
-            colour_button->set_background_color(bt->thread_1->color());
-            DisabledButton *colour_button_2 = new DisabledButton(colour_widget, "  ");
-            colour_button_2->set_background_color(bt->thread_2->color());
-        } else {
-            DisabledButton *colour_button = new DisabledButton(_remove_threads_widget, "  ");
-            colour_button->set_background_color(t->color());
-        }
-
-        DeletePaletteButton *delete_button = new DeletePaletteButton(_remove_threads_widget, "Delete");
-        delete_button->set_thread(t);
-        delete_button->set_app(_app);
-        delete_button->set_callback();
-    }
-
+    _remove_threads_list->set_item_count(_palette_threads.size());
     _app->perform_layout();
 }
 
 void ToolWindow::create_themes() {
-    if (_palettebutton_black_text_theme == nullptr ||
-        _palettebutton_black_text_theme->m_text_color != Color(0, 255)
-    ) {
+    if (_palettebutton_black_text_theme.get() == nullptr) {
         _palettebutton_black_text_theme = new Theme(_app->nvg_context());
         _palettebutton_black_text_theme->m_text_color = Color(0, 255);
         _palettebutton_black_text_theme->m_text_color_shadow = Color(255, 255);
     }
 
-    if (
-        _palettebutton_white_text_theme == nullptr ||
-        _palettebutton_white_text_theme->m_text_color != Color(255, 255)
-    ) {
+    if (_palettebutton_white_text_theme.get() == nullptr) {
         _palettebutton_white_text_theme = new Theme(_app->nvg_context());
         _palettebutton_white_text_theme->m_text_color = Color(255, 255);
         _palettebutton_white_text_theme->m_text_color_shadow = Color(0, 255);
     }
 }
 
-void ToolWindow::update_palette_widget() {
-    if (_palette_container != nullptr) {
-        remove_child(_palette_container);
-        _palette_container = nullptr;
-    }
-
-    _palette_container = new VScrollPanel(this);
+Theme *ToolWindow::thread_text_theme(Thread *t) {
+    if ((t->R * 0.2126f) + (t->G * 0.7152f) + (t->B * 0.0722f) > 179)
+        return _palettebutton_black_text_theme;
+    return _palettebutton_white_text_theme;
+}
 
-    int palette_size = 0;
+void ToolWindow::update_palette_widget() {
+    _palette_threads.clear();
     for (Thread *t : _app->_project->palette)
         if (t != nullptr)
-            palette_size++;
-
-    if (palette_size < 1) {
-        _app->perform_layout();
-        _remove_from_palette_button->set_enabled(false);
-        return;
-    }
-
-    _remove_from_palette_button->set_enabled(true);
-
-    Widget *palette_widget = new Widget(_palette_container);
-    palette_widget->set_layout(new GroupLayout(0, 5, 0, 0));
-    for (Thread *t : _app->_project->palette) {
-        if (t == nullptr)
-            continue;
-        PaletteButton *button = new PaletteButton(palette_widget);
-        button->set_thread(t);
-        button->set_app(m_parent);
-        button->set_callback();
-        button->set_background_color(t->color());
-        button->set_tooltip(t->description(t->default_position()));
-        button->set_caption(t->full_name(t->default_position()));
-        create_themes(); // Check if either theme has been deleted by nanogui reference counting
-        if ((t->R * 0.2126f) + (t->G * 0.7152f) + (t->B * 0.0722f) > 179) {
-            button->set_theme(_palettebutton_black_text_theme);
-        } else {
-            button->set_theme(_palettebutton_white_text_theme);
-        }
-    }
+            _palette_threads.push_back(t);
 
-    if (palette_size > 10)
-        _palette_container->set_fixed_height(370);
+    bool has_threads = !_palette_threads.empty();
+    _remove_from_palette_button->set_enabled(has_threads);
+    // Only the rows in view are bound, so this is quick however big the palette is
+    _palette_list->set_visible(has_threads);
+    _palette_list->set_item_count(_palette_threads.size());
 
     _app->perform_layout();
 };
@@ -428,9 +432,11 @@ void ToolWindow::update_selected_thread_widget() {
             _selected_thread_theme->m_text_color_shadow = Color(0, 255);
         }
 
-        _selected_thread_button->set_tooltip(t->description(t->default_position()));
-        _selected_thread_button->set_caption(t->full_name(t->default_position()));
+        _selected_thread_button->set_tooltip(std::string(t->description(t->default_position())));
+        _selected_thread_button->set_caption(std::string(t->full_name(t->default_position())));
     }
+
+    _app->perform_layout();
 };
 
 // Returns true if the mouse coordinates provided intersect with this window
@@ -3,6 +3,7 @@
 #include <nanogui/nanogui.h>
 #include "constants.hpp"
 #include "threads.hpp"
+#include "thread_search.hpp"
 
 class ThemeNoRefCount : public nanogui::Theme {
 public:
@@ -23,7 +24,41 @@ public:
     };
 };
 
+// A text box that calls its edit callback after every change, not just once editing finishes
+class SearchBox : public nanogui::TextBox {
+public:
+    SearchBox(nanogui::Widget *parent) : nanogui::TextBox(parent, "") {
+        set_editable(true);
+        set_alignment(nanogui::TextBox::Alignment::Left);
+    };
+    void set_edit_callback(const std::function<void(const std::string&)>& callback) { _edit_callback = callback; };
+
+    virtual bool keyboard_event(int key, int scancode, int action, int modifiers) override {
+        bool handled = nanogui::TextBox::keyboard_event(key, scancode, action, modifiers);
+        edited();
+        return handled;
+    };
+    virtual bool keyboard_character_event(unsigned int codepoint) override {
+        bool handled = nanogui::TextBox::keyboard_character_event(codepoint);
+        edited();
+        return handled;
+    };
+
+private:
+    std::function<void(const std::string&)> _edit_callback;
+    std::string _last_value;
+
+    void edited() {
+        if (m_value_temp == _last_value)
+            return;
+        _last_value = m_value_temp;
+        if (_edit_callback)
+            _edit_callback(_last_value);
+    };
+};
+
 class XStitchEditorApplication;
+class VirtualList;
 
 class PaletteButton : public nanogui::Button {
 public:
@@ -76,16 +111,19 @@ public:
     void update_palette_widget();
     void update_selected_thread_widget();
     void update_remove_thread_widget();
-    void update_thread_list_popups(nanogui::PopupButton *add_thread_btn);
+    // Fills add_thread_btn's popup with a search box and a grid of the matching threads
+    void create_thread_search_popup(nanogui::PopupButton *add_thread_btn);
     void create_themes();
+    // The shared theme whose text can be read on top of t's colour
+    nanogui::Theme *thread_text_theme(Thread *t);
     void reset_add_thread_form();
 
     nanogui::PopupButton *_add_to_palette_button;
     nanogui::PopupButton *_remove_from_palette_button;
     nanogui::Widget *_add_to_palette_widget;
-    nanogui::Widget *_remove_from_palette_widget;
-    nanogui::Theme *_palettebutton_black_text_theme = nullptr;
-    nanogui::Theme *_palettebutton_white_text_theme = nullptr;
+    // Shared by every button showing a thread, whichever text colour shows up on it
+    nanogui::ref<nanogui::Theme> _palettebutton_black_text_theme;
+    nanogui::ref<nanogui::Theme> _palettebutton_white_text_theme;
     nanogui::PopupButton *_add_thread_popup_button;
     nanogui::PopupButton *_add_blend_thread_popup_button;
     nanogui::Button *_clear_threads_button;
@@ -102,9 +140,13 @@ private:
 
     DisabledButton *_selected_thread_button;
     nanogui::Label *_selected_thread_label;
-    nanogui::VScrollPanel *_palette_container;
     nanogui::Theme *_selected_thread_theme;
 
-    nanogui::VScrollPanel *_remove_threads_scroll_panel;
-    nanogui::Widget *_remove_threads_widget = nullptr;
+    // The palette without its empty slots, which both palette lists show
+    std::vector<Thread*> _palette_threads;
+    VirtualList *_palette_list;
+    VirtualList *_remove_threads_list;
+    bool _thread_lists_built = false;
+    // Every catalogue's threads, built along with the thread lists
+    ThreadSearchIndex _thread_search;
 };
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include <nanogui/opengl.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "virtual_grid.hpp"
+
+// Pixels scrolled by one step of the mouse wheel
+#define SCROLL_STEP 40.f
+
+using namespace nanogui;
+
+VirtualGrid::VirtualGrid(Widget *parent, int columns, const Vector2i& cell_size, int spacing, int max_height,
+                         CellFactory create_cell, CellBinder bind_cell)
+: Widget(parent), _cell_size(cell_size), _columns(std::max(1, columns)), _spacing(spacing),
+  _max_height(max_height), _create_cell(create_cell), _bind_cell(bind_cell) {
+    if (max_height < 1)
+        throw std::invalid_argument("A virtual grid needs a max height to limit the cells it makes");
+}
+
+void VirtualGrid::set_item_count(int count) {
+    _item_count = std::max(0, count);
+    _scroll = 0.f;
+    update_cells(true);
+}
+
+void VirtualGrid::refresh() {
+    update_cells(true);
+}
+
+Vector2i VirtualGrid::preferred_size(NVGcontext *ctx) const {
+    int width = (_columns * _cell_size[0]) + ((_columns - 1) * _spacing) + VIRTUAL_GRID_SCROLLBAR_WIDTH;
+    if (m_fixed_size[1] > 0)
+        return Vector2i(width, m_fixed_size[1]);
+    return Vector2i(width, std::min(content_height(), _max_height));
+}
+
+void VirtualGrid::perform_layout(NVGcontext *ctx) {
+    // Only the cells in view exist, so this is the same amount of work however many items there are
+    for (Widget *cell : _cells) {
+        cell->set_size(_cell_size);
+        cell->perform_layout(ctx);
+    }
+    scroll_to(_scroll);
+}
+
+bool VirtualGrid::mouse_button_event(const Vector2i &p, int button, bool down, int modifiers) {
+    if (button == GLFW_MOUSE_BUTTON_1 && !down)
+        _dragging_scrollbar = false;
+
+    if (button == GLFW_MOUSE_BUTTON_1 && down && content_height() > visible_height() &&
+        p[0] >= m_pos[0] + m_size[0] - VIRTUAL_GRID_SCROLLBAR_WIDTH) {
+        _dragging_scrollbar = true;
+        return true;
+    }
+
+    return Widget::mouse_button_event(p, button, down, modifiers);
+}
+
+bool VirtualGrid::mouse_drag_event(const Vector2i &p, const Vector2i &rel, int button, int modifiers) {
+    if (!_dragging_scrollbar)
+        return Widget::mouse_drag_event(p, rel, button, modifiers);
+
+    // The scrollbar is the view's height scaled down, so moving it moves the view further
+    scroll_to(_scroll + (rel[1] * (float)content_height() / std::max(1, visible_height())));
+    return true;
+}
+
+bool VirtualGrid::scroll_event(const Vector2i &p, const Vector2f &rel) {
+    if (content_height() <= visible_height())
+        return Widget::scroll_event(p, rel);
+
+    scroll_to(_scroll - (rel[1] * SCROLL_STEP));
+    return true;
+}
+
+void VirtualGrid::draw(NVGcontext *ctx) {
+    nvgSave(ctx);
+    nvgIntersectScissor(ctx, m_pos[0], m_pos[1], m_size[0], m_size[1]);
+    Widget::draw(ctx);
+    nvgRestore(ctx);
+
+    int content = content_height();
+    if (content <= m_size[1])
+        return;
+
+    // Same look as nanogui's VScrollPanel
+    float scroll_h = std::max(20.f, m_size[1] * ((float)m_size[1] / content));
+    float fraction = _scroll / (content - m_size[1]);
+    float x = m_pos[0] + m_size[0] - VIRTUAL_GRID_SCROLLBAR_WIDTH;
+
+    NVGpaint paint = nvgBoxGradient(ctx, x + 1, m_pos[1] + 4 + 1, 8, m_size[1] - 8, 3, 4, Color(0, 32), Color(0, 92));
+    nvgBeginPath(ctx);
+    nvgRoundedRect(ctx, x, m_pos[1] + 4, 8, m_size[1] - 8, 3);
+    nvgFillPaint(ctx, paint);
+    nvgFill(ctx);
+
+    float thumb_y = m_pos[1] + 4 + ((m_size[1] - 8 - scroll_h) * fraction);
+    paint = nvgBoxGradient(ctx, x - 1, thumb_y - 1, 8, scroll_h, 3, 4, Color(220, 100), Color(128, 100));
+    nvgBeginPath(ctx);
+    nvgRoundedRect(ctx, x + 1, thumb_y + 1, 8 - 2, scroll_h - 2, 2);
+    nvgFillPaint(ctx, paint);
+    nvgFill(ctx);
+}
+
+int VirtualGrid::visible_height() const {
+    if (m_size[1] > 0)
+        return m_size[1];
+    if (m_fixed_size[1] > 0)
+        return m_fixed_size[1];
+    return std::min(content_height(), _max_height);
+}
+
+int VirtualGrid::content_height() const {
+    int rows = (_item_count + _columns - 1) / _columns;
+    return rows > 0 ? (rows * row_height()) - _spacing : 0;
+}
+
+void VirtualGrid::scroll_to(float scroll) {
+    float max_scroll = std::max(0, content_height() - visible_height());
+    _scroll = std::clamp(scroll, 0.f, max_scroll);
+    update_cells(false);
+}
+
+void VirtualGrid::update_cells(bool rebind) {
+    // Enough rows to fill the view, plus one more for when the top and bottom rows are both cut off
+    int rows = (visible_height() + row_height() - 1) / row_height() + 1;
+    size_t cells_needed = (size_t)rows * _columns;
+    if (_cells.size() < cells_needed) {
+        while (_cells.size() < cells_needed) {
+            Widget *cell = _create_cell(this);
+            cell->set_size(_cell_size);
+            cell->set_visible(false);
+            _cells.push_back(cell);
+            _cell_items.push_back(-1);
+        }
+        // Items map to different cells now there are more of them
+        rebind = true;
+    }
+
+    int first_item = ((int)_scroll / row_height()) * _columns;
+    int last_item = std::min(_item_count, first_item + (int)cells_needed);
+    for (size_t i = 0; i < _cells.size(); i++) {
+        if (_cell_items[i] < first_item || _cell_items[i] >= last_item) {
+            _cells[i]->set_visible(false);
+            _cell_items[i] = -1;
+        }
+    }
+
+    NVGcontext *ctx = screen() != nullptr ? screen()->nvg_context() : nullptr;
+    for (int item = first_item; item < last_item; item++) {
+        size_t i = item % _cells.size();
+        Widget *cell = _cells[i];
+        if (rebind || _cell_items[i] != item) {
+            _bind_cell(cell, item);
+            _cell_items[i] = item;
+            if (ctx != nullptr)
+                cell->perform_layout(ctx);
+        }
+
+        int row = item / _columns;
+        int column = item % _columns;
+        cell->set_position(Vector2i(column * (_cell_size[0] + _spacing), (row * row_height()) - (int)_scroll));
+        cell->set_visible(true);
+    }
+}
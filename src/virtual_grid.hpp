@@ -0,0 +1,87 @@
+#pragma once
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <nanogui/nanogui.h>
+
+// Width of the scrollbar, which is drawn over the right hand edge of the grid
+#define VIRTUAL_GRID_SCROLLBAR_WIDTH 12
+
+/* A scrolling grid of equally sized cells that only has widgets for the rows that can be seen.
+Scrolling hands the cells that leave the view to the items coming into it, so laying out and
+drawing the grid costs the same however many items it holds. Its fixed height is how much of the
+grid can be seen at once, or without one it grows with its items up to its max height. The max
+height is required, as a grid that could grow to fit every item would make a cell for each one. */
+class VirtualGrid : public nanogui::Widget {
+public:
+    // Creates an empty cell as a child of grid
+    using CellFactory = std::function<nanogui::Widget*(nanogui::Widget *grid)>;
+    // Makes cell show the item at index
+    using CellBinder = std::function<void(nanogui::Widget *cell, int index)>;
+
+    // Throws std::invalid_argument if max_height is less than 1
+    VirtualGrid(nanogui::Widget *parent, int columns, const nanogui::Vector2i& cell_size, int spacing, int max_height,
+                CellFactory create_cell, CellBinder bind_cell);
+
+    int item_count() const { return _item_count; };
+    // Scrolls back to the top and shows the first of count items
+    void set_item_count(int count);
+    // Shows the visible items again, for when they change without their number changing
+    void refresh();
+
+    virtual nanogui::Vector2i preferred_size(NVGcontext *ctx) const override;
+    virtual void perform_layout(NVGcontext *ctx) override;
+    virtual bool mouse_button_event(const nanogui::Vector2i &p, int button, bool down, int modifiers) override;
+    virtual bool mouse_drag_event(const nanogui::Vector2i &p, const nanogui::Vector2i &rel, int button, int modifiers) override;
+    virtual bool scroll_event(const nanogui::Vector2i &p, const nanogui::Vector2f &rel) override;
+    virtual void draw(NVGcontext *ctx) override;
+
+protected:
+    nanogui::Vector2i _cell_size;
+
+private:
+    int row_height() const { return _cell_size[1] + _spacing; };
+    int visible_height() const;
+    int content_height() const;
+    void scroll_to(float scroll);
+    // Makes enough cells to fill every row that can be seen, and moves each one to the item in its
+    // place, binding it again if that item changed (or always if rebind is set)
+    void update_cells(bool rebind);
+
+    int _columns;
+    int _spacing;
+    // Tallest the grid grows to when it has no fixed height
+    int _max_height;
+    CellFactory _create_cell;
+    CellBinder _bind_cell;
+    int _item_count = 0;
+    // How far down the grid the top of the view is, in pixels
+    float _scroll = 0.f;
+    bool _dragging_scrollbar = false;
+    // Item i is always shown by cell i % _cells.size()
+    std::vector<nanogui::Widget*> _cells;
+    // Item each cell was last bound to, -1 if it is hidden
+    std::vector<int> _cell_items;
+};
+
+// A VirtualGrid with a single column of rows, each as wide as the list is laid out to be
+class VirtualList : public VirtualGrid {
+public:
+    // row_size's width is only the width the list would like to be
+    VirtualList(nanogui::Widget *parent, const nanogui::Vector2i& row_size, int spacing, int max_height,
+                CellFactory create_row, CellBinder bind_row)
+    : VirtualGrid(parent, 1, row_size, spacing, max_height, create_row, bind_row), _row_width(row_size[0]) {};
+
+    virtual nanogui::Vector2i preferred_size(NVGcontext *ctx) const override {
+        nanogui::Vector2i size = VirtualGrid::preferred_size(ctx);
+        size[0] = _row_width + VIRTUAL_GRID_SCROLLBAR_WIDTH;
+        return size;
+    };
+    virtual void perform_layout(NVGcontext *ctx) override {
+        _cell_size[0] = std::max(0, m_size[0] - VIRTUAL_GRID_SCROLLBAR_WIDTH);
+        VirtualGrid::perform_layout(ctx);
+    };
+
+private:
+    int _row_width;
+};
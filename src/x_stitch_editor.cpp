@@ -17,8 +17,18 @@
 #include "canvas_renderer.hpp"
 #include "camera2d.hpp"
 #include "threads.hpp"
+#include "catalogue.hpp"
 #include "project.hpp"
 #include "constants.hpp"
+#include "paths.hpp"
+#include "profiler.hpp"
+#include "profiler_overlay.hpp"
+
+// Frame time of the old fixed 60Hz redraw, which camera movement used to be scaled by. Keys and the
+// scroll wheel move the camera by the same amount each event now frames are only drawn on demand.
+#define CAMERA_STEP (1 / 60.f)
+// Seconds after the mouse stops until nanogui has finished fading a tooltip in
+#define TOOLTIP_FADE_END 1.0
 
 using namespace nanogui;
 
@@ -78,22 +88,15 @@ XStitchEditorApplication::XStitchEditorApplication() :
 }
 
 void XStitchEditorApplication::load_all_threads() {
-    // TODO: once installed designate a folder to contain manufacturer.xml files
-    // and attempt to load all of those here. If a user adds a new manufacturer file
-    // and it is valid then it should be copied to this folder
-
-    std::map<std::string, Thread*> *dmc_threads = new std::map<std::string, Thread*>;
-    try {
-        std::string resources_dir = get_resources_dir();
-        if (resources_dir == "")
-            throw std::runtime_error("Couldn't fetch resource directory");
-        std::string path = resources_dir + "/DMC.xml";
-        std::string manufacturer_name = load_manufacturer(path.c_str(), dmc_threads);
-        _threads[manufacturer_name] = dmc_threads;
-    } catch (std::runtime_error& err) {
-        delete dmc_threads;
-        std::cerr << fmt::format("Could not load thread manufacturer DMC: {}", err.what()) << std::endl;
-    }
+    // TODO: If a user adds a new manufacturer file and it is valid then it should be copied to
+    // the catalogues folder
+    std::string resources_dir = get_resources_dir();
+    if (resources_dir == "")
+        std::cerr << "Could not load thread manufacturers: Couldn't fetch resource directory" << std::endl;
+
+    // Only lists the manufacturers, so startup doesn't wait for their threads to load
+    _catalogues = new CatalogueDirectory(resources_dir + "/catalogues");
+    _catalogues->load_in_background();
 };
 
 void XStitchEditorApplication::switch_project(Project *project) {
@@ -186,7 +189,7 @@ void XStitchEditorApplication::open_project() {
     Project *project;
 
     try {
-        project = new Project(path.c_str(), &_threads);
+        project = new Project(path.c_str(), _catalogues);
     } catch (const std::runtime_error& err) {
         new nanogui::MessageDialog(this, nanogui::MessageDialog::Type::Warning, "Error", err.what());
         return;
@@ -196,16 +199,26 @@ void XStitchEditorApplication::open_project() {
     switch_application_state(ApplicationStates::PROJECT_OPEN);
 }
 
+void XStitchEditorApplication::draw_all() {
+    // Called on every pass of the main loop, but only draws once something has asked for a redraw
+    if (!m_redraw)
+        return;
+
+    PROFILE_SCOPE("frame");
+    Screen::draw_all();
+}
+
+void XStitchEditorApplication::perform_layout() {
+    PROFILE_SCOPE("layout");
+    Screen::perform_layout();
+}
+
 void XStitchEditorApplication::draw_contents() {
     if (!_canvas_renderer->_drawing) {
         Screen::draw_contents();
         return;
     }
 
-    double current_frame = glfwGetTime();
-    _time_delta = current_frame - _last_frame;
-    _last_frame = current_frame;
-
     // TODO: iterate visible windows, calculate if they are out of view
     // if they are, put them back to their default position
 
@@ -219,9 +232,23 @@ void XStitchEditorApplication::draw_contents() {
     } else {
         mouse_position_window->set_visible(false);
     }
-    perform_layout();
 };
 
+void XStitchEditorApplication::draw(NVGcontext *ctx) {
+    {
+        PROFILE_SCOPE("draw widgets");
+        Screen::draw(ctx);
+    }
+
+    if (_profiler_overlay != nullptr)
+        _profiler_overlay->draw(ctx, width());
+
+    // Tooltips fade in once the mouse has been still for a while, so keep drawing until they have
+    const Widget *hovered = find_widget(m_mouse_pos);
+    if (hovered != nullptr && !hovered->tooltip().empty() && glfwGetTime() - m_last_interaction < TOOLTIP_FADE_END)
+        redraw();
+}
+
 bool XStitchEditorApplication::keyboard_event(int key, int scancode, int action, int modifiers) {
     if (Screen::keyboard_event(key, scancode, action, modifiers))
         return true;
@@ -231,6 +258,29 @@ bool XStitchEditorApplication::keyboard_event(int key, int scancode, int action,
         return true;
     }
 
+    // Profiling only records while the overlay is shown
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        if (_profiler_overlay == nullptr) {
+            _profiler_overlay = new ProfilerOverlay();
+        } else {
+            delete _profiler_overlay;
+            _profiler_overlay = nullptr;
+        }
+        Profiler::instance().set_enabled(_profiler_overlay != nullptr);
+        return true;
+    }
+
+    if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+        std::string path = get_cache_dir() + "/trace.json";
+        try {
+            Profiler::instance().write_chrome_trace(path);
+            new MessageDialog(this, MessageDialog::Type::Information, "Trace Saved", fmt::format("Saved the profiler's timings to {}", path));
+        } catch (const std::runtime_error& err) {
+            new MessageDialog(this, MessageDialog::Type::Warning, "Error", err.what());
+        }
+        return true;
+    }
+
     if (!_canvas_renderer->_drawing)
         return false;
 
@@ -246,13 +296,13 @@ bool XStitchEditorApplication::keyboard_event(int key, int scancode, int action,
             std::string path = nanogui::file_dialog(permitted_files, true);
 
             if (path != "")
-                _project->save(path.c_str(), this);
+                _project->save(path.c_str());
         } else {
-            _project->save(_project->file_path.c_str(), this);
+            _project->save(_project->file_path.c_str());
         }
     }
 
-    float camera_speed = 2 * _time_delta;
+    float camera_speed = 2 * CAMERA_STEP;
 
     if (key == GLFW_KEY_LEFT)
         _canvas_renderer->_camera->pan_camera(Vector2f(camera_speed, 0), _canvas_renderer->_position);
@@ -281,7 +331,7 @@ bool XStitchEditorApplication::scroll_event(const nanogui::Vector2i &p, const na
     // We only care about vertical scroll
     if (rel[1] != 0.f) {
         nanogui::Vector2f mouse_ndc = _canvas_renderer->_camera->screen_to_ortho_ndc(p);
-        float zoom_factor = 1.f + (rel[1] *_time_delta);
+        float zoom_factor = 1.f + (rel[1] * CAMERA_STEP);
         _canvas_renderer->_camera->zoom_to_point(mouse_ndc, zoom_factor, _canvas_renderer->_position);
     }
 
@@ -374,16 +424,29 @@ bool XStitchEditorApplication::mouse_button_event(const Vector2i &p, int button,
         }
     }
 
+    redraw();
     return false;
 }
 
 bool XStitchEditorApplication::mouse_motion_event(const Vector2i &p, const Vector2i &rel, int button, int modifiers) {
+    // Widgets are highlighted while the mouse is over them
+    Widget *hovered = find_widget(p);
+    if (hovered != _hovered_widget) {
+        _hovered_widget = hovered;
+        redraw();
+    }
+
     if (Widget::mouse_motion_event(p, rel, button, modifiers))
         return true;
 
     if (!_canvas_renderer->_drawing)
         return false;
 
+    // The mouse position window shows the stitch under the mouse
+    if (_canvas_renderer->get_stitch_at(p) != _canvas_renderer->_selected_stitch ||
+        _canvas_renderer->get_substitch_at(p) != _canvas_renderer->_selected_sub_stitch)
+        redraw();
+
     // TODO: check that this gets the right result on windows/linux and
     // that it isn't just a weird glfw quirk
 #if defined(__APPLE__)
@@ -8,12 +8,14 @@
 #include "threads.hpp"
 
 class ToolWindow;
+class CatalogueDirectory;
 class MousePositionWindow;
 class SplashScreenWindow;
 class NewProjectWindow;
 class MainMenuWindow;
 class PDFWindow;
 class DitheringWindow;
+class ProfilerOverlay;
 class CanvasRenderer;
 struct Project;
 class XStitchEditorApplication;
@@ -30,15 +32,22 @@ private:
 
     ApplicationStates _previous_state = ApplicationStates::LAUNCH;
 
-    float _last_frame = 0.0f;
-    float _time_delta = 0.0f;
+    // Shown while profiling, toggled with F3
+    ProfilerOverlay *_profiler_overlay = nullptr;
+    // Widget last under the mouse, only compared against as it may have been deleted since
+    nanogui::Widget *_hovered_widget = nullptr;
 public:
     XStitchEditorApplication();
     void load_all_threads();
     void switch_project(Project *project);
     void switch_application_state(ApplicationStates state);
     void open_project();
+    virtual void draw_all();
+    // Screen::perform_layout isn't virtual, so this hides it to time every layout asked for
+    using Screen::perform_layout;
+    void perform_layout();
     virtual void draw_contents();
+    virtual void draw(NVGcontext *ctx);
     virtual bool keyboard_event(int key, int scancode, int action, int modifiers);
     virtual bool scroll_event(const nanogui::Vector2i &p, const nanogui::Vector2f &rel);
     virtual bool mouse_button_event(const nanogui::Vector2i &p, int button, bool down, int modifiers);
@@ -58,6 +67,6 @@ public:
     Project *_project = nullptr;
     ToolOptions _selected_tool = ToolOptions::MOVE;
     Thread *_selected_thread = nullptr;
-    std::map<std::string, std::map<std::string, Thread*>*> _threads;
+    CatalogueDirectory *_catalogues = nullptr;
     nanogui::Vector2f _previous_backstitch_point = NO_SUBSTITCH_SELECTED;
 };
\ No newline at end of file